@@ -0,0 +1,302 @@
+/*
+ * cap2rep.c - Turn a log written by the capture shim (capture.c) into
+ *     a trace for the driver.
+ *
+ *     usage: cap2rep [-b] <in.cap> <out>
+ *
+ * The events are put back into the order given by their seq numbers
+ * and replayed against a hash table from addresses to block ids, so
+ * that every block gets the dense id that traceop_t.index expects and
+ * keeps it across reallocs. The old block of a realloc leaves the table
+ * at the CAP_REALLOC_OLD event logged before the call, and its id waits
+ * under the caller's thread id until the CAP_REALLOC event after the
+ * call; an address glibc hands to another thread in between therefore
+ * gets an id of its own. Output is a text .rep file, or with -b a
+ * binary trace (see trace.h) that also keeps the thread (numbered from
+ * 0 in order of appearance) and the time of every request. The
+ * suggested heap size is set to the peak of the live payload bytes.
+ *
+ * Frees and reallocs of blocks the log never saw allocated (made
+ * before the shim started, or by memalign and friends) are dropped,
+ * as are failed calls. Zero-byte requests become one-byte requests,
+ * since the driver cannot check a zero-sized payload, and realloc to
+ * zero bytes becomes a free.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture.h"
+#include "trace.h"
+
+#define EMPTY 0ULL  /* key of a slot never used */
+#define GONE  1ULL  /* key of a slot whose entry was removed */
+
+int verbose = 0; /* read by read_trace */
+
+/* Open-addressing hash table from addresses (or thread ids) to ids */
+typedef struct {
+    unsigned long long *keys;
+    int *vals;
+    size_t mask;
+} map_t;
+
+static void map_init(map_t *m, size_t n);
+static int *map_find(map_t *m, unsigned long long key);
+static int *map_add(map_t *m, unsigned long long key);
+static void map_remove(map_t *m, unsigned long long key);
+static int cmp_seq(const void *a, const void *b);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    cap_event_t *ev;
+    struct stat st;
+    trace_t trace;
+    traceop_t *op;
+    map_t blocks, threads, pending;
+    long long *live;
+    long long live_bytes = 0, peak = 0;
+    size_t nev, i;
+    int binary = 0, dropped = 0, nthreads = 0;
+    int fd, c, old, *id, *tid;
+
+    while ((c = getopt(argc, argv, "bh")) != EOF) {
+        switch (c) {
+        case 'b': /* Write a binary trace with threads and times */
+            binary = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        exit(1);
+    }
+
+    /* Map the log and sort a private copy of it by seq */
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    nev = st.st_size / sizeof(cap_event_t);
+    if (nev == 0 || nev > INT_MAX) {
+        fprintf(stderr, "cap2rep: %s holds %lu events\n", argv[optind],
+                (unsigned long)nev);
+        exit(1);
+    }
+    ev = mmap(NULL, nev * sizeof(cap_event_t), PROT_READ | PROT_WRITE,
+              MAP_PRIVATE, fd, 0);
+    if (ev == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    close(fd);
+    qsort(ev, nev, sizeof(cap_event_t), cmp_seq);
+
+    trace.ops = malloc(nev * sizeof(traceop_t));
+    trace.tids = malloc(nev * sizeof(int));
+    trace.times = malloc(nev * sizeof(long long));
+    live = malloc(nev * sizeof(long long));
+    if (!trace.ops || !trace.tids || !trace.times || !live) {
+        fprintf(stderr, "cap2rep: out of memory\n");
+        exit(1);
+    }
+    map_init(&blocks, nev);
+    map_init(&threads, nev);
+    map_init(&pending, nev);
+    trace.num_ids = 0;
+    trace.num_ops = 0;
+
+    for (i = 0; i < nev; i++) {
+        op = &trace.ops[trace.num_ops];
+        if (ev[i].size > INT_MAX) {
+            dropped++;
+            continue;
+        }
+        switch (ev[i].type) {
+        case CAP_MALLOC:
+        case CAP_CALLOC:
+            if (ev[i].ptr == 0) {
+                dropped++;
+                continue;
+            }
+            if ((id = map_find(&blocks, ev[i].ptr)) != NULL) {
+                live_bytes -= live[*id]; /* its free was lost in a race */
+                map_remove(&blocks, ev[i].ptr);
+            }
+            op->type = ALLOC;
+            op->index = trace.num_ids++;
+            op->size = ev[i].size ? ev[i].size : 1;
+            *map_add(&blocks, ev[i].ptr) = op->index;
+            break;
+        case CAP_REALLOC_OLD:
+            /* the old block's id waits for the thread's CAP_REALLOC */
+            map_remove(&pending, ev[i].tid + 2ULL);
+            if ((id = map_find(&blocks, ev[i].old)) != NULL) {
+                *map_add(&pending, ev[i].tid + 2ULL) = *id;
+                map_remove(&blocks, ev[i].old);
+            }
+            continue;
+        case CAP_REALLOC:
+            id = ev[i].old ? map_find(&pending, ev[i].tid + 2ULL) : NULL;
+            old = id != NULL ? *id : -1;
+            if (id != NULL)
+                map_remove(&pending, ev[i].tid + 2ULL);
+            if (ev[i].ptr == 0 && !(old >= 0 && ev[i].size == 0)) {
+                if (old >= 0) /* failed: the old block is still there */
+                    *map_add(&blocks, ev[i].old) = old;
+                dropped++; /* failed, or realloc(NULL, 0) */
+                continue;
+            }
+            if (old < 0) { /* realloc(NULL, n) or of an unknown block */
+                if (ev[i].old)
+                    dropped++;
+                op->type = ALLOC;
+                op->index = trace.num_ids++;
+            } else {
+                op->type = ev[i].size ? REALLOC : FREE;
+                op->index = old;
+                live_bytes -= live[op->index];
+            }
+            if (op->type == FREE)
+                break;
+            op->size = ev[i].size ? ev[i].size : 1;
+            if ((id = map_find(&blocks, ev[i].ptr)) != NULL) {
+                live_bytes -= live[*id];
+                map_remove(&blocks, ev[i].ptr);
+            }
+            *map_add(&blocks, ev[i].ptr) = op->index;
+            break;
+        case CAP_FREE:
+            if ((id = map_find(&blocks, ev[i].ptr)) == NULL) {
+                dropped++;
+                continue;
+            }
+            op->type = FREE;
+            op->index = *id;
+            op->size = 0;
+            live_bytes -= live[op->index];
+            map_remove(&blocks, ev[i].ptr);
+            break;
+        default:
+            fprintf(stderr, "cap2rep: bogus event %lu\n", (unsigned long)i);
+            exit(1);
+        }
+        if (op->type != FREE) {
+            live[op->index] = op->size;
+            live_bytes += op->size;
+            peak = live_bytes > peak ? live_bytes : peak;
+        }
+        if ((tid = map_find(&threads, ev[i].tid + 2ULL)) == NULL) {
+            tid = map_add(&threads, ev[i].tid + 2ULL);
+            *tid = nthreads++;
+        }
+        trace.tids[trace.num_ops] = *tid;
+        trace.times[trace.num_ops] = ev[i].ns > ev[0].ns ?
+            ev[i].ns - ev[0].ns : 0;
+        trace.num_ops++;
+    }
+    trace.sugg_heapsize = peak > INT_MAX ? INT_MAX : peak;
+    trace.weight = 1;
+
+    if ((binary ? write_trace(&trace, argv[optind+1]) :
+         write_rep(&trace, argv[optind+1])) < 0) {
+        perror(argv[optind+1]);
+        exit(1);
+    }
+    printf("%s: %d ops, %d ids, %d threads, %d calls dropped\n",
+           argv[optind+1], trace.num_ops, trace.num_ids, nthreads, dropped);
+    return 0;
+}
+
+/*
+ * map_init - Make m an empty table with room for n entries at no more
+ *     than half load
+ */
+static void map_init(map_t *m, size_t n)
+{
+    size_t size = 16;
+
+    while (size < 2 * n)
+        size <<= 1;
+    m->keys = calloc(size, sizeof(unsigned long long));
+    m->vals = malloc(size * sizeof(int));
+    if (m->keys == NULL || m->vals == NULL) {
+        fprintf(stderr, "cap2rep: out of memory\n");
+        exit(1);
+    }
+    m->mask = size - 1;
+}
+
+#define HASH(m, key) (((key) * 0x9e3779b97f4a7c15ULL >> 17) & (m)->mask)
+
+/*
+ * map_find - Return the value stored under key, or NULL
+ */
+static int *map_find(map_t *m, unsigned long long key)
+{
+    size_t i;
+
+    for (i = HASH(m, key); m->keys[i] != EMPTY; i = (i + 1) & m->mask) {
+        if (m->keys[i] == key)
+            return &m->vals[i];
+    }
+    return NULL;
+}
+
+/*
+ * map_add - Add key, which must not be in m yet, and return its value.
+ *     Removed slots are not reused, so a table sized for every event
+ *     in the log never fills up.
+ */
+static int *map_add(map_t *m, unsigned long long key)
+{
+    size_t i;
+
+    for (i = HASH(m, key); m->keys[i] != EMPTY; i = (i + 1) & m->mask)
+        ;
+    m->keys[i] = key;
+    return &m->vals[i];
+}
+
+/*
+ * map_remove - Remove key from m if it is there
+ */
+static void map_remove(map_t *m, unsigned long long key)
+{
+    int *val = map_find(m, key);
+
+    if (val != NULL)
+        m->keys[val - m->vals] = GONE;
+}
+
+/*
+ * cmp_seq - qsort comparison putting events in the order of their calls
+ */
+static int cmp_seq(const void *a, const void *b)
+{
+    const cap_event_t *x = a, *y = b;
+
+    return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: cap2rep [-bh] <in.cap> <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b  Write a binary trace with thread ids and times.\n");
+    fprintf(stderr, "\t-h  Print this message.\n");
+}
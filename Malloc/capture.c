@@ -0,0 +1,275 @@
+/*
+ * capture.c - LD_PRELOAD shim that records the malloc, calloc, realloc
+ *     and free calls of a real program, for cap2rep to turn into a
+ *     trace the driver can replay.
+ *
+ *     LD_PRELOAD=./capture.so MM_CAPTURE=app.cap ./app
+ *
+ * Every call is passed straight on to glibc (through its __libc_*
+ * entry points, so no dlsym bootstrap is needed) and then logged as a
+ * cap_event_t with the caller's thread id and a timestamp. Each thread
+ * fills its own buffer without locking and appends it to the log with
+ * one write() when it is full, when the thread exits and when the
+ * process exits, so the lock and the system call are paid once per
+ * CAP_EVENTS calls. The only shared write per call is the atomic
+ * increment that orders the calls across threads: it is taken after
+ * an allocation returns and before a block is freed, so a block is
+ * always logged as allocated before anyone frees it, and as freed
+ * before the address is handed out again. A realloc of a block is
+ * logged twice for that reason: glibc may free the old block before it
+ * returns, so the old block is given up by a CAP_REALLOC_OLD event
+ * taken before the call, and the result is logged by a CAP_REALLOC
+ * event taken after it. cap2rep joins the two into one request.
+ *
+ * Without MM_CAPTURE in the environment nothing is recorded; a %p in
+ * it stands for the process id. Calls the
+ * shim makes itself, calls made before its constructor has run and
+ * calls in a child after fork are not recorded either; neither are
+ * memalign and friends, whose blocks cap2rep skips when they are freed.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "capture.h"
+
+#define CAP_EVENTS 4096 /* calls buffered per thread between writes */
+
+/* glibc's own allocator, under the names it exports for shims */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/* Buffer of one thread; buffers of exited threads are reused */
+typedef struct cap_buf {
+    struct cap_buf *next; /* list of all buffers, for the flush at exit */
+    int idle;             /* owner has exited */
+    int n;                /* events in ev */
+    cap_event_t ev[CAP_EVENTS];
+} cap_buf_t;
+
+static int cap_fd = -1;              /* the log, or -1 if not recording */
+static unsigned long long cap_seq;   /* next event's position */
+static cap_buf_t *cap_bufs;          /* all buffers */
+static pthread_mutex_t cap_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cap_key;        /* flushes a buffer at thread exit */
+
+static __thread cap_buf_t *cap_mine; /* this thread's buffer */
+static __thread int cap_tid;         /* this thread's kernel id */
+static __thread int cap_busy;        /* set inside the shim: don't record */
+
+/*
+ * cap_flush - Append the events of b to the log. Called with cap_lock
+ *     held, which keeps the batches of different threads apart.
+ */
+static void cap_flush(cap_buf_t *b)
+{
+    char *p = (char *)b->ev;
+    size_t left = b->n * sizeof(cap_event_t);
+    ssize_t n;
+
+    while (left > 0 && cap_fd >= 0) {
+        if ((n = write(cap_fd, p, left)) <= 0)
+            break;
+        p += n;
+        left -= n;
+    }
+    b->n = 0;
+}
+
+/*
+ * cap_exit_thread - Flush the buffer of an exiting thread and leave it
+ *     for the next new thread
+ */
+static void cap_exit_thread(void *arg)
+{
+    cap_buf_t *b = arg;
+
+    pthread_mutex_lock(&cap_lock);
+    cap_flush(b);
+    b->idle = 1;
+    pthread_mutex_unlock(&cap_lock);
+    cap_mine = NULL;
+}
+
+/*
+ * cap_buffer - Give the calling thread a buffer: an idle one if there
+ *     is one, else a fresh mapping
+ */
+static cap_buf_t *cap_buffer(void)
+{
+    cap_buf_t *b;
+
+    pthread_mutex_lock(&cap_lock);
+    for (b = cap_bufs; b != NULL && !b->idle; b = b->next)
+        ;
+    if (b == NULL) {
+        b = mmap(NULL, sizeof(cap_buf_t), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (b == MAP_FAILED) {
+            pthread_mutex_unlock(&cap_lock);
+            return NULL;
+        }
+        b->next = cap_bufs;
+        cap_bufs = b;
+    }
+    b->idle = 0;
+    b->n = 0;
+    pthread_mutex_unlock(&cap_lock);
+
+    cap_tid = syscall(SYS_gettid);
+    pthread_setspecific(cap_key, b);
+    return cap_mine = b;
+}
+
+/*
+ * cap_record - Log one call of the current thread
+ */
+static void cap_record(int type, void *ptr, void *old, size_t size,
+                       unsigned long long seq)
+{
+    cap_buf_t *b = cap_mine;
+    cap_event_t *e;
+    struct timespec ts;
+
+    if (b == NULL && (b = cap_buffer()) == NULL)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    e = &b->ev[b->n];
+    e->seq = seq;
+    e->ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    e->ptr = (unsigned long)ptr;
+    e->old = (unsigned long)old;
+    e->size = size;
+    e->tid = cap_tid;
+    e->type = type;
+    if (++b->n == CAP_EVENTS) {
+        pthread_mutex_lock(&cap_lock);
+        cap_flush(b);
+        pthread_mutex_unlock(&cap_lock);
+    }
+}
+
+#define RECORDING() (cap_fd >= 0 && !cap_busy)
+#define NEXT_SEQ() __atomic_fetch_add(&cap_seq, 1, __ATOMIC_SEQ_CST)
+
+void *malloc(size_t size)
+{
+    void *p = __libc_malloc(size);
+
+    if (RECORDING()) {
+        cap_busy = 1;
+        cap_record(CAP_MALLOC, p, NULL, size, NEXT_SEQ());
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p = __libc_calloc(nmemb, size);
+
+    if (RECORDING()) {
+        cap_busy = 1;
+        cap_record(CAP_CALLOC, p, NULL, nmemb * size, NEXT_SEQ());
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (ptr != NULL && RECORDING()) {
+        cap_busy = 1;
+        cap_record(CAP_REALLOC_OLD, NULL, ptr, size, NEXT_SEQ());
+        cap_busy = 0;
+    }
+    p = __libc_realloc(ptr, size);
+    if (RECORDING()) {
+        cap_busy = 1;
+        cap_record(CAP_REALLOC, p, ptr, size, NEXT_SEQ());
+        cap_busy = 0;
+    }
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr != NULL && RECORDING()) {
+        cap_busy = 1;
+        cap_record(CAP_FREE, ptr, NULL, 0, NEXT_SEQ());
+        cap_busy = 0;
+    }
+    __libc_free(ptr);
+}
+
+/*
+ * cap_child - The child of a fork stops recording; its copy of the
+ *     buffers belongs to the parent's log
+ */
+static void cap_child(void)
+{
+    cap_fd = -1;
+}
+
+/*
+ * cap_init - Open the log named by MM_CAPTURE before main() runs. A %p
+ *     in the name becomes the process id, so that programs the traced
+ *     one starts, which inherit the variable, get logs of their own.
+ */
+__attribute__((constructor))
+static void cap_init(void)
+{
+    char *name = getenv("MM_CAPTURE");
+    char path[PATH_MAX];
+    size_t i, n;
+    int fd;
+
+    if (name == NULL || *name == '\0')
+        return;
+    for (i = 0, n = 0; name[i] != '\0' && n < sizeof(path) - 16; i++) {
+        if (name[i] == '%' && name[i+1] == 'p') {
+            n += snprintf(path + n, 16, "%d", (int)getpid());
+            i++;
+        } else
+            path[n++] = name[i];
+    }
+    path[n] = '\0';
+
+    cap_busy = 1;
+    if (pthread_key_create(&cap_key, cap_exit_thread) == 0 &&
+        pthread_atfork(NULL, NULL, cap_child) == 0 &&
+        (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                   0644)) >= 0)
+        cap_fd = fd;
+    cap_busy = 0;
+}
+
+/*
+ * cap_fini - Flush every buffer still holding events and close the log
+ */
+__attribute__((destructor))
+static void cap_fini(void)
+{
+    cap_buf_t *b;
+    int fd = cap_fd;
+
+    if (fd < 0)
+        return;
+    pthread_mutex_lock(&cap_lock);
+    for (b = cap_bufs; b != NULL; b = b->next)
+        cap_flush(b);
+    cap_fd = -1;
+    pthread_mutex_unlock(&cap_lock);
+    close(fd);
+}
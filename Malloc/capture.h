@@ -0,0 +1,24 @@
+/*
+ * capture.h - Raw event records that the capture shim (capture.c)
+ *     appends to its log and cap2rep turns into a trace.
+ *
+ * The log is nothing but these records, written in per-thread
+ * batches; seq gives the order in which the calls took effect.
+ */
+#ifndef __CAPTURE_H_
+#define __CAPTURE_H_
+
+enum {CAP_MALLOC, CAP_CALLOC, CAP_REALLOC, CAP_FREE, CAP_REALLOC_OLD};
+
+typedef struct {
+    unsigned long long seq;  /* position of the call in the process */
+    unsigned long long ns;   /* CLOCK_MONOTONIC time of the call */
+    unsigned long long ptr;  /* block returned, or freed by CAP_FREE */
+    unsigned long long old;  /* block passed to realloc (or given up by
+                                CAP_REALLOC_OLD, just before the call) */
+    unsigned long long size; /* bytes asked for */
+    int tid;                 /* kernel thread id of the caller */
+    int type;                /* CAP_MALLOC ... CAP_REALLOC_OLD */
+} cap_event_t;
+
+#endif /* __CAPTURE_H_ */
@@ -53,15 +53,34 @@
 #define UTIL_WEIGHT .60
 
 /* 
- * Alignment requirement in bytes (either 4 or 8) 
+ * Alignment requirement in bytes: 8 for 32-bit builds, 16 for LP64
+ * builds, where malloc must return memory aligned for long double
  */
+#ifdef __LP64__
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8  
+#endif
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes, by default (see mdriver -H)
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Maximum number of independently growing heap regions of MAX_HEAP
+ * bytes each (one per arena of a multi-arena mm.c). Their address space
+ * is reserved up front but only touched as the regions grow.
+ */
+#define MAX_REGIONS 16
+
+/*
+ * mm.c links free blocks by 32-bit offsets from the start of region 0,
+ * counted in ALIGNMENT units, so all the regions together may span at
+ * most this many bytes (64 GB on LP64); memlib refuses larger regions.
+ */
+#define MAX_HEAP_SPAN ((unsigned long long)ALIGNMENT << 32)
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
@@ -0,0 +1,440 @@
+/*
+ * gentrace.c - Generate synthetic traces from a seeded workload model,
+ *     for stress and scalability tests far larger than the traces in
+ *     traces/.
+ *
+ *     usage: gentrace [-bh] [-S seed] [-n ops] [-H heap] [-d pow|bi]
+ *                     [-m min] [-M max] [-a alpha] [-p small]
+ *                     [-l fifo|lifo|random|gen] [-y young]
+ *                     [-r chains] [-g growth] [-c steps] <out>
+ *
+ * Block sizes follow either a power law, P(size) ~ size^-alpha between
+ * min and max, or a bimodal mix, where a fraction of the blocks is up
+ * to 25% below min and the rest up to 25% below max. Every block gets
+ * a death key when it is allocated, and blocks die in the order of
+ * their keys: the order of allocation for fifo, the reverse for lifo, a
+ * random order for random. For gen (the generational hypothesis) a
+ * fraction of the blocks is young and dies after an exponentially
+ * distributed number of later allocations (YOUNG_LIFE on average),
+ * whether or not the heap is full; the others are tenured and die
+ * oldest first. Before each allocation, blocks are freed until the new
+ * one fits into the live-heap target, so the live payload climbs to
+ * that target and then stays there.
+ *
+ * A fraction of the allocations starts a realloc chain, like a vector
+ * growing as it is filled: on about every other request after that the
+ * block is reallocated to growth times its size, until it has grown
+ * steps times, would exceed half the target, or dies. Only one chain
+ * runs at a time.
+ *
+ * Generation stops at the requested number of requests, counting the
+ * frees of the blocks still live at the end, which close the trace.
+ * The same seed gives the same trace on every machine. Counts and
+ * sizes take K, M and G suffixes; the heap target may be up to 2G, as
+ * sugg_heapsize is an int. Output is a text .rep file, or with -b a
+ * binary trace (see trace.h), which loads much faster for millions of
+ * requests.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <math.h>
+
+#include "trace.h"
+
+#define YOUNG_LIFE 64          /* mean life of young blocks, in allocations */
+#define TENURED (1LL << 62)    /* death keys of tenured blocks start here */
+
+int verbose = 0; /* read by read_trace */
+
+enum {SIZE_POW, SIZE_BI};
+enum {LIFE_FIFO, LIFE_LIFO, LIFE_RANDOM, LIFE_GEN};
+
+/* Live blocks, as a binary min-heap on their death keys */
+typedef struct {
+    long long *key;
+    int *id;
+    int n;
+} queue_t;
+
+static unsigned long long rng_state;
+
+static unsigned long long rng(void);
+static double uniform(void);
+static int pick_size(int dist, double min, double max, double alpha,
+                     double small);
+static void queue_push(queue_t *q, long long key, int id);
+static int queue_pop(queue_t *q);
+static long long parse_size(char *s);
+static void *xmalloc(size_t size);
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    trace_t trace;
+    traceop_t *op;
+    queue_t live;
+    int *sizes;
+    long long now, key, live_bytes = 0, peak = 0;
+    long long seed = 1, ops = 1000000, heap = 64 << 20;
+    long long min = 16, max = 64 << 10;
+    double alpha = 1.5, small = 0.9, young = 0.9, chains = 0, growth = 1.5;
+    double grown;
+    int dist = SIZE_POW, life = LIFE_RANDOM, steps = 8, binary = 0;
+    int chain = -1, chain_steps = 0;
+    int c, id, size;
+
+    while ((c = getopt(argc, argv, "bhS:n:H:d:m:M:a:p:l:y:r:g:c:")) != EOF) {
+        switch (c) {
+        case 'b': /* Write a binary trace */
+            binary = 1;
+            break;
+        case 'S': /* Seed of the random number generator */
+            seed = atoll(optarg);
+            break;
+        case 'n': /* Number of requests */
+            ops = parse_size(optarg);
+            break;
+        case 'H': /* Live-heap target */
+            heap = parse_size(optarg);
+            break;
+        case 'd': /* Size distribution */
+            if (!strcmp(optarg, "pow"))
+                dist = SIZE_POW;
+            else if (!strcmp(optarg, "bi"))
+                dist = SIZE_BI;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'm': /* Smallest size, or the small mode */
+            min = parse_size(optarg);
+            break;
+        case 'M': /* Largest size, or the large mode */
+            max = parse_size(optarg);
+            break;
+        case 'a': /* Power-law exponent */
+            alpha = atof(optarg);
+            break;
+        case 'p': /* Fraction of small blocks in the bimodal mix */
+            small = atof(optarg);
+            break;
+        case 'l': /* Lifetime model */
+            if (!strcmp(optarg, "fifo"))
+                life = LIFE_FIFO;
+            else if (!strcmp(optarg, "lifo"))
+                life = LIFE_LIFO;
+            else if (!strcmp(optarg, "random"))
+                life = LIFE_RANDOM;
+            else if (!strcmp(optarg, "gen"))
+                life = LIFE_GEN;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'y': /* Fraction of young blocks in the generational model */
+            young = atof(optarg);
+            break;
+        case 'r': /* Fraction of allocations that start a realloc chain */
+            chains = atof(optarg);
+            break;
+        case 'g': /* Growth factor of each realloc in a chain */
+            growth = atof(optarg);
+            break;
+        case 'c': /* Reallocs per chain */
+            steps = atoi(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 1) {
+        usage();
+        exit(1);
+    }
+    if (ops < 2 || ops > INT_MAX || heap <= 0 || heap > INT_MAX ||
+        min < 1 || max < min || max > heap || growth <= 1 || steps < 1) {
+        fprintf(stderr, "gentrace: need 2 <= ops < 2G, 1 <= min <= max <= "
+                "heap <= 2G, growth > 1 and steps >= 1\n");
+        exit(1);
+    }
+
+    /* Every request is at most one allocation, so ops bounds the ids */
+    trace.ops = xmalloc(ops * sizeof(traceop_t));
+    trace.tids = NULL;
+    trace.times = NULL;
+    sizes = xmalloc(ops * sizeof(int));
+    live.key = xmalloc(ops * sizeof(long long));
+    live.id = xmalloc(ops * sizeof(int));
+    live.n = 0;
+    trace.num_ids = 0;
+    trace.num_ops = 0;
+    rng_state = seed;
+
+    /*
+     * Frees leave num_ops + live.n as it is, a realloc adds one and an
+     * allocation two, so this leaves room to free what is live at the end
+     */
+    while (trace.num_ops + live.n + 1 < ops) {
+        now = trace.num_ids;
+
+        /* Grow the chain, if it is still live and has steps left */
+        if (chain >= 0 && uniform() < 0.5) {
+            grown = sizes[chain] * growth;
+            if (sizes[chain] < 0 || grown > heap / 2 ||
+                chain_steps++ == steps) {
+                chain = -1;
+                continue;
+            }
+            size = grown;
+            while (live_bytes + size - sizes[chain] > heap &&
+                   sizes[chain] >= 0) {
+                id = queue_pop(&live);
+                op = &trace.ops[trace.num_ops++];
+                op->type = FREE;
+                op->index = id;
+                op->size = 0;
+                live_bytes -= sizes[id];
+                sizes[id] = -1;
+            }
+            if (sizes[chain] < 0) { /* made room by freeing the chain */
+                chain = -1;
+                continue;
+            }
+            op = &trace.ops[trace.num_ops++];
+            op->type = REALLOC;
+            op->index = chain;
+            op->size = size;
+            live_bytes += size - sizes[chain];
+            sizes[chain] = size;
+        } else {
+            /* Free the blocks that are due, then make room for a new one */
+            size = pick_size(dist, min, max, alpha, small);
+            while (live.n > 0 && (live_bytes + size > heap ||
+                                  (life == LIFE_GEN && live.key[0] <= now))) {
+                id = queue_pop(&live);
+                op = &trace.ops[trace.num_ops++];
+                op->type = FREE;
+                op->index = id;
+                op->size = 0;
+                live_bytes -= sizes[id];
+                sizes[id] = -1;
+            }
+
+            switch (life) {
+            case LIFE_FIFO:
+                key = now;
+                break;
+            case LIFE_LIFO:
+                key = -now;
+                break;
+            case LIFE_RANDOM:
+                key = rng() >> 2;
+                break;
+            default:
+                if (uniform() < young)
+                    key = now + 1 - YOUNG_LIFE * log(1 - uniform());
+                else
+                    key = TENURED + now;
+            }
+            id = trace.num_ids++;
+            op = &trace.ops[trace.num_ops++];
+            op->type = ALLOC;
+            op->index = id;
+            op->size = size;
+            sizes[id] = size;
+            live_bytes += size;
+            queue_push(&live, key, id);
+            if (chain < 0 && uniform() < chains) {
+                chain = id;
+                chain_steps = 0;
+            }
+        }
+        peak = live_bytes > peak ? live_bytes : peak;
+    }
+
+    /* Free the rest in the order they were due to die */
+    while (live.n > 0) {
+        op = &trace.ops[trace.num_ops++];
+        op->type = FREE;
+        op->index = queue_pop(&live);
+        op->size = 0;
+    }
+    trace.sugg_heapsize = peak;
+    trace.weight = 1;
+
+    if ((binary ? write_trace(&trace, argv[optind]) :
+         write_rep(&trace, argv[optind])) < 0) {
+        perror(argv[optind]);
+        exit(1);
+    }
+    printf("%s: %d ops, %d ids, peak live %lld bytes\n",
+           argv[optind], trace.num_ops, trace.num_ids, peak);
+    return 0;
+}
+
+/*
+ * rng - Return the next number of a splitmix64 sequence, which unlike
+ *     rand() is the same with every C library
+ */
+static unsigned long long rng(void)
+{
+    unsigned long long z = (rng_state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/*
+ * uniform - Return a random double in [0, 1)
+ */
+static double uniform(void)
+{
+    return (rng() >> 11) * (1.0 / (1ULL << 53));
+}
+
+/*
+ * pick_size - Draw a block size from the power law or the bimodal mix
+ */
+static int pick_size(int dist, double min, double max, double alpha,
+                     double small)
+{
+    double u = uniform(), lo, hi, size;
+
+    if (dist == SIZE_BI) {
+        size = uniform() < small ? min : max;
+        size *= 0.75 + 0.25 * u;
+    } else if (fabs(alpha - 1) < 1e-9) {
+        size = min * pow(max / min, u);
+    } else {
+        /* Invert the CDF of the power law truncated to [min, max] */
+        lo = pow(min, 1 - alpha);
+        hi = pow(max, 1 - alpha);
+        size = pow(lo + u * (hi - lo), 1 / (1 - alpha));
+    }
+    if (size < 1)
+        return 1;
+    return size > max ? max : (int)size;
+}
+
+/*
+ * queue_push - Add block id, which dies at key
+ */
+static void queue_push(queue_t *q, long long key, int id)
+{
+    int i = q->n++, parent;
+
+    while (i > 0 && q->key[parent = (i - 1) / 2] > key) {
+        q->key[i] = q->key[parent];
+        q->id[i] = q->id[parent];
+        i = parent;
+    }
+    q->key[i] = key;
+    q->id[i] = id;
+}
+
+/*
+ * queue_pop - Remove and return the block that is due to die first
+ */
+static int queue_pop(queue_t *q)
+{
+    int top = q->id[0], i = 0, child;
+    long long key = q->key[--q->n];
+    int id = q->id[q->n];
+
+    while ((child = 2 * i + 1) < q->n) {
+        if (child + 1 < q->n && q->key[child + 1] < q->key[child])
+            child++;
+        if (q->key[child] >= key)
+            break;
+        q->key[i] = q->key[child];
+        q->id[i] = q->id[child];
+        i = child;
+    }
+    q->key[i] = key;
+    q->id[i] = id;
+    return top;
+}
+
+/*
+ * parse_size - Parse a number with an optional K, M or G suffix
+ */
+static long long parse_size(char *s)
+{
+    char *end;
+    long long n = strtoll(s, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g':
+        n <<= 10;
+        /* fall through */
+    case 'M': case 'm':
+        n <<= 10;
+        /* fall through */
+    case 'K': case 'k':
+        n <<= 10;
+        end++;
+    }
+    if (end == s || *end != '\0') {
+        fprintf(stderr, "gentrace: bad number %s\n", s);
+        exit(1);
+    }
+    return n;
+}
+
+/*
+ * xmalloc - malloc that exits when it runs out of memory
+ */
+static void *xmalloc(size_t size)
+{
+    void *p = malloc(size);
+
+    if (p == NULL) {
+        fprintf(stderr, "gentrace: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: gentrace [-bh] [-S seed] [-n ops] [-H heap] "
+            "[-d pow|bi] [-m min]\n"
+            "                [-M max] [-a alpha] [-p small] "
+            "[-l fifo|lifo|random|gen]\n"
+            "                [-y young] [-r chains] [-g growth] "
+            "[-c steps] <out>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b          Write a binary trace.\n");
+    fprintf(stderr, "\t-S <seed>   Seed (default 1).\n");
+    fprintf(stderr, "\t-n <ops>    Number of requests (default 1M).\n");
+    fprintf(stderr, "\t-H <heap>   Live-heap target in bytes (default 64M).\n");
+    fprintf(stderr, "\t-d pow|bi   Power-law or bimodal sizes (default pow).\n");
+    fprintf(stderr, "\t-m <min>    Smallest size or small mode (default 16).\n");
+    fprintf(stderr, "\t-M <max>    Largest size or large mode (default 64K).\n");
+    fprintf(stderr, "\t-a <alpha>  Power-law exponent (default 1.5).\n");
+    fprintf(stderr, "\t-p <small>  Fraction of small blocks with -d bi "
+            "(default 0.9).\n");
+    fprintf(stderr, "\t-l <model>  Lifetimes: fifo, lifo, random or gen "
+            "(default random).\n");
+    fprintf(stderr, "\t-y <young>  Fraction of young blocks with -l gen "
+            "(default 0.9).\n");
+    fprintf(stderr, "\t-r <chains> Fraction of allocations that start a "
+            "realloc chain (default 0).\n");
+    fprintf(stderr, "\t-g <growth> Growth factor of chain reallocs "
+            "(default 1.5).\n");
+    fprintf(stderr, "\t-c <steps>  Reallocs per chain (default 8).\n");
+    fprintf(stderr, "\t-h          Print this message.\n");
+}
@@ -0,0 +1,91 @@
+/*
+ * hist.c - Log-bucketed latency histograms (see hist.h).
+ */
+#include <string.h>
+
+#include "hist.h"
+
+/*
+ * hist_bucket - Return the bucket of value v
+ */
+static int hist_bucket(unsigned long long v)
+{
+    int e;
+
+    if (v < HIST_SUB)
+        return v;
+    e = 63 - __builtin_clzll(v); /* v is in [2^e, 2^(e+1)) */
+    return (e - HIST_SUB_BITS + 1) * HIST_SUB +
+        (int)(v >> (e - HIST_SUB_BITS)) - HIST_SUB;
+}
+
+/*
+ * hist_top - Return the largest value that falls into bucket i
+ */
+static unsigned long long hist_top(int i)
+{
+    int shift = i / HIST_SUB - 1;
+
+    if (i < HIST_SUB)
+        return i;
+    return ((unsigned long long)(HIST_SUB + i % HIST_SUB + 1) << shift) - 1;
+}
+
+/*
+ * hist_init - Empty histogram h
+ */
+void hist_init(hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+/*
+ * hist_add - Count value v in histogram h
+ */
+void hist_add(hist_t *h, unsigned long long v)
+{
+    h->bucket[hist_bucket(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v > h->max)
+        h->max = v;
+}
+
+/*
+ * hist_merge - Add the counts of histogram src to dst
+ */
+void hist_merge(hist_t *dst, hist_t *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+        dst->bucket[i] += src->bucket[i];
+    dst->count += src->count;
+    dst->sum += src->sum;
+    if (src->max > dst->max)
+        dst->max = src->max;
+}
+
+/*
+ * hist_percentile - Return the value below which fraction p of the
+ *     values in h lie, rounded up to the top of its bucket but never
+ *     above the largest value seen. An empty histogram gives 0.
+ */
+unsigned long long hist_percentile(hist_t *h, double p)
+{
+    unsigned long long seen = 0, rank, top;
+    int i;
+
+    if (h->count == 0)
+        return 0;
+    rank = (unsigned long long)(p * h->count);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen > rank)
+            break;
+    }
+    top = hist_top(i);
+    return top < h->max ? top : h->max;
+}
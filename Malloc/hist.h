@@ -0,0 +1,28 @@
+/*
+ * hist.h - Log-bucketed latency histograms for the driver.
+ *
+ * Values below HIST_SUB get a bucket each; above that every power of
+ * two is split into HIST_SUB buckets, so a percentile read back from
+ * the histogram is within 1/HIST_SUB of the true value however wide
+ * the range of latencies is.
+ */
+#ifndef __HIST_H_
+#define __HIST_H_
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)   /* buckets per power of two */
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    unsigned long long count;                /* values added */
+    unsigned long long sum;                  /* their total */
+    unsigned long long max;                  /* the largest of them */
+    unsigned long long bucket[HIST_BUCKETS]; /* values per bucket */
+} hist_t;
+
+void hist_init(hist_t *h);
+void hist_add(hist_t *h, unsigned long long v);
+void hist_merge(hist_t *dst, hist_t *src);
+unsigned long long hist_percentile(hist_t *h, double p);
+
+#endif /* __HIST_H_ */
@@ -7,19 +7,26 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* for sched_setaffinity */
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sched.h>
+#include <sys/wait.h>
 #include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <float.h>
 #include <time.h>
+#include <stdint.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
+#include "replay.h"
+#include "perf.h"
 
 /**********************
  * Constants and macros
@@ -29,39 +36,24 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAX_JOBS      64 /* most child processes for -j */
+#define PERF_RUNS      3 /* runs averaged by the -C counters */
 
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of a splay tree */
 typedef struct range_t {
-    char *lo;              /* low payload address */
+    char *lo;              /* low payload address, the key */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* payloads at lower addresses */
+    struct range_t *right; /* payloads at higher addresses */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
-
 /* 
  * Holds the params to the xxx_speed functions, which are timed by fcyc. 
  * This struct is necessary because fcyc accepts only a pointer array
@@ -82,6 +74,9 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* with -C, events per run of the trace, or -1 if not counted */
+    double counts[PERF_EVENTS];
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -90,6 +85,11 @@ typedef struct {
  *******************/
 int verbose = 0;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
+static int check_interval = 0; /* -c: full heap check every this many ops */
+static int jobs = 1;    /* -j: traces evaluated at once, in child processes */
+static size_t heap_size = MAX_HEAP;       /* -H: bytes per heap region */
+static int heap_pages = MEM_PAGES_SMALL;  /* -P: pages backing the heap */
+static int counters = 0; /* -C: count hardware events of the timing runs */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
 /* Directory where default tracefiles are found */
@@ -105,16 +105,13 @@ static char *default_tracefiles[] = {
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
+static range_t *splay_range(range_t *t, char *lo);
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
-/* These functions read, allocate, and free storage for traces */
-static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
-
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
 static void eval_libc_speed(void *ptr);
@@ -122,11 +119,20 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
+static int check_heap(int tracenum, int opnum, void *bp);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
+static void eval_mm_frag(trace_t *trace, char *name, FILE *csv, int interval);
 static void eval_mm_speed(void *ptr);
+static void run_mm(int n, char **tracefiles, stats_t *stats);
+static void run_trace(int i, char *tracefile, stats_t *stats);
+static void run_mm_parallel(int n, char **tracefiles, stats_t *stats);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printtradeoff(int n, stats_t *eager, stats_t *deferred);
+static void printcounters(int n, stats_t *stats);
+static void printinfo(void);
+static size_t parse_size(char *s);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -142,14 +148,25 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
+    stats_t *defer_stats = NULL; /* mm stats with deferred coalescing */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int defer_bytes = 0; /* If set, also run mm with deferred coalescing (-d) */
+    int max_threads = 0; /* If set, replay on up to this many threads (-T) */
+    int replay_mode = REPLAY_COPY; /* How -T spreads a trace (-s, -x) */
+    int latency = 0;     /* If set, time every request of mm and libc (-L) */
+    latency_t *lat = NULL; /* latencies of one trace, then of all, per allocator */
+    int m;               /* allocator of a latency run: 0 libc, 1 mm */
+    char *frag_file = NULL; /* If set, write heap layout snapshots here (-F) */
+    int frag_interval = 0;  /* ops between snapshots (-i), 0 for 100 per trace */
+    int place = MM_PLACE_BEST; /* placement policy of mm (-A) */
+    FILE *csv;
+    char label[MAXLINE];
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +175,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgald:c:T:sxLF:i:j:H:P:CA:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +201,81 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'd': /* Compare with deferred coalescing */
+            if ((defer_bytes = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'c': /* Check the heap while validating */
+            if ((check_interval = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'T': /* Replay on up to this many threads at once */
+            if ((max_threads = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 's': /* Split each trace across the threads by block id */
+            replay_mode = REPLAY_SHARD;
+            break;
+        case 'x': /* Split it, and free each block on the next thread */
+            replay_mode = REPLAY_HANDOFF;
+            break;
+        case 'F': /* Write heap layout snapshots to a CSV file */
+            frag_file = optarg;
+            break;
+        case 'i': /* Ops between two heap layout snapshots */
+            if ((frag_interval = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'j': /* Evaluate this many traces at once */
+            if ((jobs = atoi(optarg)) <= 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'H': /* Size of each simulated heap region */
+            if ((heap_size = parse_size(optarg)) == 0) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'P': /* Back the simulated heap with huge pages */
+            if (!strcmp(optarg, "thp"))
+                heap_pages = MEM_PAGES_THP;
+            else if (!strcmp(optarg, "huge"))
+                heap_pages = MEM_PAGES_HUGETLB;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'A': /* Placement policy of mm */
+            if (!strcmp(optarg, "best"))
+                place = MM_PLACE_BEST;
+            else if (!strcmp(optarg, "addr"))
+                place = MM_PLACE_ADDR;
+            else if (!strcmp(optarg, "lifo"))
+                place = MM_PLACE_LIFO;
+            else if (!strcmp(optarg, "bump"))
+                place = MM_PLACE_BUMP;
+            else {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'C': /* Count hardware events per request */
+            counters = 1;
+            break;
+        case 'L': /* Print per-request latency percentiles */
+            latency = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -229,6 +321,10 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (counters && init_perf() == 0) {
+	printf("No performance counters available, ignoring -C\n");
+	counters = 0;
+    }
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -254,6 +350,9 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		if (counters)
+		    perf_count(eval_libc_speed, &speed_params, PERF_RUNS,
+			       libc_stats[i].counts);
 	    }
 	    free_trace(trace);
 	}
@@ -263,6 +362,10 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	if (counters) {
+	    printf("\nEvents per request for libc malloc:\n");
+	    printcounters(num_tracefiles, libc_stats);
+	}
     }
 
     /*
@@ -277,27 +380,12 @@ int main(int argc, char **argv)
 	unix_error("mm_stats calloc in main failed");
     
     /* Initialize the simulated memory system in memlib.c */
-    mem_init(); 
+    mem_init_sized(heap_size, heap_pages);
+    if (place != MM_PLACE_BEST && !mm_mallopt(MM_OPT_PLACE, place))
+	app_error("mm_mallopt rejected MM_OPT_PLACE");
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-	}
-	free_trace(trace);
-    }
+    run_mm(num_tracefiles, tracefiles, mm_stats);
 
     /* Display the mm results in a compact table */
     if (verbose) {
@@ -305,6 +393,109 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (counters) {
+	printf("Events per request for mm malloc:\n");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally run the mm package again with deferred coalescing,
+     * and show what it gains in throughput and loses in utilization
+     */
+    if (defer_bytes > 0) {
+	if (verbose > 1)
+	    printf("\nTesting mm malloc with deferred coalescing\n");
+	defer_stats = (stats_t *)calloc(num_tracefiles, sizeof(stats_t));
+	if (defer_stats == NULL)
+	    unix_error("defer_stats calloc in main failed");
+	if (!mm_mallopt(MM_OPT_DEFER, defer_bytes))
+	    app_error("mm_mallopt rejected MM_OPT_DEFER");
+	run_mm(num_tracefiles, tracefiles, defer_stats);
+	mm_mallopt(MM_OPT_DEFER, 0);
+
+	printf("\nEager vs. deferred coalescing (%d bytes of quick bins):\n",
+	       defer_bytes);
+	printtradeoff(num_tracefiles, mm_stats, defer_stats);
+	printf("\n");
+    }
+
+    /*
+     * Optionally replay each trace on 1, 2, 4, ... threads at once with
+     * libc malloc and mm, once mm has been shown to be correct
+     */
+    if (max_threads > 0 && errors == 0) {
+	printf("\nThreaded replay, %s, up to %d threads:\n",
+	       replay_mode == REPLAY_SHARD ? "trace split by block id" :
+	       replay_mode == REPLAY_HANDOFF ?
+	       "trace split by block id, freed on the next thread" :
+	       "one copy per thread",
+	       max_threads);
+	printf("%-4s%-5s %7s %9s %7s %7s %7s %7s %9s\n", "tr", "alloc",
+	       "threads", "Kops", "speedup", "p50ns", "p99ns", "p999ns", "maxns");
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    replay_threads(trace, i, max_threads, replay_mode);
+	    free_trace(trace);
+	}
+	printf("\n");
+    }
+
+    /*
+     * Optionally time each request of each trace on its own, with libc
+     * malloc and mm, and show the latency percentiles per request type
+     * and size: for every trace with -v, and for all traces together
+     */
+    if (latency && errors == 0) {
+	if ((lat = (latency_t *)malloc(4 * sizeof(latency_t))) == NULL)
+	    unix_error("lat malloc in main failed");
+	latency_init(&lat[2]);
+	latency_init(&lat[3]);
+	printf("\nLatency per request in ns:\n");
+	printf("%-4s%-5s %-7s %-5s %9s %7s %7s %7s %9s\n", "tr", "alloc",
+	       "op", "size", "count", "p50", "p99", "p999", "max");
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    for (m = 0; m < 2; m++) {
+		latency_init(&lat[m]);
+		if (!replay_latency(trace, m, &lat[m])) {
+		    printf("%-4d%s: allocation failed\n", i, m ? "mm" : "libc");
+		    continue;
+		}
+		sprintf(label, "%d", i);
+		if (verbose)
+		    print_latency(label, m, &lat[m]);
+		latency_merge(&lat[2 + m], &lat[m]);
+	    }
+	    free_trace(trace);
+	}
+	for (m = 0; m < 2; m++)
+	    print_latency("all", m, &lat[2 + m]);
+	printf("\n");
+	free(lat);
+    }
+
+    /*
+     * Optionally profile how each trace fragments the mm heap over time
+     */
+    if (frag_file != NULL && errors == 0) {
+	if ((csv = fopen(frag_file, "w")) == NULL)
+	    unix_error("Could not open the -F file");
+	fprintf(csv, "trace,op,heap,payload,internal,parked,free,slot_free,"
+		"other,free_blocks,largest_free,alloc,util,external_frag");
+	for (i = 0; i < MM_LAYOUT_BINS; i++)
+	    fprintf(csv, ",free_%d", 16 << i);
+	fprintf(csv, "\n");
+	for (i = 0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_frag(trace, tracefiles[i], csv, frag_interval > 0 ?
+			 frag_interval : (trace->num_ops + 99) / 100);
+	    free_trace(trace);
+	}
+	if (fclose(csv) != 0)
+	    unix_error("Could not write the -F file");
+	printf("Heap layout snapshots written to %s\n", frag_file);
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -359,22 +550,79 @@ int main(int argc, char **argv)
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. Payloads
+ * never overlap, so ordering them by their low address is enough:
+ * a new payload can only overlap its two neighbors in that order.
+ * The tree is a splay tree, so each operation costs O(log n)
+ * amortized however many blocks are live.
  ****************************************************************/
 
+/*
+ * splay_range - Top-down splay of tree t around address lo. Returns the
+ *     new root: the range starting at lo if there is one, otherwise the
+ *     range just before or just after lo.
+ */
+static range_t *splay_range(range_t *t, char *lo)
+{
+    range_t n, *l, *r, *y;
+
+    if (t == NULL)
+	return NULL;
+    n.left = n.right = NULL;
+    l = r = &n;
+    while (lo != t->lo) {
+	if (lo < t->lo) {
+	    if (t->left == NULL)
+		break;
+	    if (lo < t->left->lo) {          /* rotate right */
+		y = t->left;
+		t->left = y->right;
+		y->right = t;
+		t = y;
+		if (t->left == NULL)
+		    break;
+	    }
+	    r->left = t;                     /* link right */
+	    r = t;
+	    t = t->left;
+	}
+	else {
+	    if (t->right == NULL)
+		break;
+	    if (lo > t->right->lo) {         /* rotate left */
+		y = t->right;
+		t->right = y->left;
+		y->left = t;
+		t = y;
+		if (t->right == NULL)
+		    break;
+	    }
+	    l->right = t;                    /* link left */
+	    l = t;
+	    t = t->right;
+	}
+    }
+    l->right = t->left;                      /* assemble */
+    r->left = t->right;
+    t->left = n.right;
+    t->right = n.left;
+    return t;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we create a range struct for this block and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *t;
+    range_t *pred = NULL, *succ = NULL;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -387,35 +635,53 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or a mapping */
+    if (!mem_in_heap(lo, hi)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads. After splaying
+     * around lo, the root is one neighbor of the new payload and the
+     * other one is the nearest node of the root's other subtree, which
+     * a second splay brings up to the top of that subtree.
+     */
+    if ((t = splay_range(*ranges, lo)) != NULL) {
+	if (t->lo <= lo) {
+	    pred = t;
+	    succ = t->right = splay_range(t->right, lo);
+	}
+	else {
+	    succ = t;
+	    pred = t->left = splay_range(t->left, lo);
+	}
+    }
+    *ranges = t;
+    if ((p = (pred != NULL && pred->hi >= lo) ? pred :
+	 (succ != NULL && succ->lo <= hi) ? succ : NULL) != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and making it the root of the tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
+    p->left = pred;
+    p->right = succ;
+    if (t == pred && t != NULL)      /* split t off its right subtree */
+	t->right = NULL;
+    else if (t != NULL)              /* or off its left subtree */
+	t->left = NULL;
     *ranges = p;
     return 1;
 }
@@ -425,19 +691,23 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
-    int size;
+    range_t *t = splay_range(*ranges, lo);
+    range_t *x;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    if (t == NULL || t->lo != lo) {
+	*ranges = t;
+	return;
+    }
+
+    /* The largest range below lo becomes the new root */
+    if (t->left == NULL)
+	*ranges = t->right;
+    else {
+	x = splay_range(t->left, lo);
+	x->right = t->right;
+	*ranges = x;
     }
+    free(t);
 }
 
 /*
@@ -445,123 +715,163 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
-
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+    range_t *p = *ranges;
+    range_t *y;
+
+    /* Rotate left children up until the root has none, then free it */
+    while (p != NULL) {
+	if (p->left != NULL) {
+	    y = p->left;
+	    p->left = y->right;
+	    y->right = p;
+	    p = y;
+	}
+	else {
+	    y = p->right;
+	    free(p);
+	    p = y;
+	}
     }
     *ranges = NULL;
 }
 
 
-/**********************************************
- * The following routines manipulate tracefiles
- *********************************************/
+/**********************************************************************
+ * The following functions evaluate the correctness, space utilization,
+ * and throughput of the libc and mm malloc packages.
+ **********************************************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * run_mm - Evaluate the mm malloc package on every trace, filling in
+ *     one stats_t per trace; with -j, in several processes at once
  */
-static trace_t *read_trace(char *tracedir, char *filename)
+static void run_mm(int n, char **tracefiles, stats_t *stats)
+{
+    int i;
+
+    if (jobs > 1) {
+	run_mm_parallel(n, tracefiles, stats);
+	return;
+    }
+    for (i=0; i < n; i++)
+	run_trace(i, tracefiles[i], &stats[i]);
+}
+
+/*
+ * run_trace - Check, measure the utilization of and time the mm malloc
+ *     package on trace number i, read from tracefile, into *stats
+ */
+static void run_trace(int i, char *tracefile, stats_t *stats)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+    range_t *ranges = NULL;
+    speed_t speed_params;
 
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
     if (verbose > 1)
-	printf("Reading tracefile: %s\n", filename);
-
-    /* Allocate the trace record */
-    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
-	unix_error("malloc 1 failed in read_trance");
-	
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-	sprintf(msg, "Could not open %s in read_trace", path);
-	unix_error(msg);
-    }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));     
-    fscanf(tracefile, "%d", &(trace->num_ops));     
-    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
-    
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops = 
-	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-	unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-	switch(type[0]) {
-	case 'a':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = ALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'r':
-	    fscanf(tracefile, "%u %u", &index, &size);
-	    trace->ops[op_index].type = REALLOC;
-	    trace->ops[op_index].index = index;
-	    trace->ops[op_index].size = size;
-	    max_index = (index > max_index) ? index : max_index;
-	    break;
-	case 'f':
-	    fscanf(tracefile, "%ud", &index);
-	    trace->ops[op_index].type = FREE;
-	    trace->ops[op_index].index = index;
-	    break;
-	default:
-	    printf("Bogus type character (%c) in tracefile %s\n", 
-		   type[0], path);
-	    exit(1);
-	}
-	op_index++;
-	
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, i, &ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, i, &ranges);
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->secs = fsecs(eval_mm_speed, &speed_params);
+	if (counters)
+	    perf_count(eval_mm_speed, &speed_params, PERF_RUNS, stats->counts);
+	if (verbose > 1)
+	    printinfo();
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-    
-    return trace;
+    clear_ranges(&ranges);
+    free_trace(trace);
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * run_mm_parallel - Evaluate the traces in up to jobs child processes
+ *     at once. Each child is pinned to a CPU of its own, taken in order
+ *     from the CPUs this process may run on, so that no two timing runs
+ *     share a core; there are never more children than such CPUs. A
+ *     child evaluates one trace on the copy of the simulated heap it
+ *     inherited and sends its stats_t and error count back through a
+ *     pipe.
  */
-void free_trace(trace_t *trace)
+static void run_mm_parallel(int n, char **tracefiles, stats_t *stats)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);      
-    free(trace->block_sizes);
-    free(trace);              /* and the trace record itself... */
-}
+    cpu_set_t allowed, one;
+    int cpus[MAX_JOBS], ncpus = 0, njobs;
+    pid_t pids[MAX_JOBS];
+    int fds[MAX_JOBS], tracenum[MAX_JOBS];
+    int next = 0, running = 0, status, fd[2], cpu, j;
+    struct { stats_t stats; int errors; } result;
+    pid_t pid;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	unix_error("sched_getaffinity failed in run_mm_parallel");
+    for (cpu = 0; cpu < CPU_SETSIZE && ncpus < MAX_JOBS; cpu++)
+	if (CPU_ISSET(cpu, &allowed))
+	    cpus[ncpus++] = cpu;
+    njobs = jobs < ncpus ? jobs : ncpus;
+    if (verbose > 1)
+	printf("Evaluating %d traces in %d processes\n", n, njobs);
+    for (j = 0; j < njobs; j++)
+	pids[j] = 0;
+
+    while (next < n || running > 0) {
+	/* Start a child on every idle CPU while there are traces left */
+	for (j = 0; j < njobs && next < n; j++) {
+	    if (pids[j] != 0)
+		continue;
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in run_mm_parallel");
+	    fflush(stdout);
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in run_mm_parallel");
+	    if (pid == 0) {
+		close(fd[0]);
+		CPU_ZERO(&one);
+		CPU_SET(cpus[j], &one);
+		if (sched_setaffinity(0, sizeof(one), &one) < 0)
+		    unix_error("sched_setaffinity failed in run_mm_parallel");
+		memset(&result, 0, sizeof(result));
+		errors = 0; /* count only this trace's */
+		run_trace(next, tracefiles[next], &result.stats);
+		result.errors = errors;
+		fflush(stdout);
+		if (write(fd[1], &result, sizeof(result)) != sizeof(result))
+		    _exit(1);
+		_exit(0);
+	    }
+	    close(fd[1]);
+	    pids[j] = pid;
+	    fds[j] = fd[0];
+	    tracenum[j] = next++;
+	    running++;
+	}
 
-/**********************************************************************
- * The following functions evaluate the correctness, space utilization,
- * and throughput of the libc and mm malloc packages.
- **********************************************************************/
+	/* Collect whichever child finishes first */
+	if ((pid = wait(&status)) < 0)
+	    unix_error("wait failed in run_mm_parallel");
+	for (j = 0; j < njobs && pids[j] != pid; j++)
+	    ;
+	if (j == njobs)
+	    continue;
+	if (read(fds[j], &result, sizeof(result)) != sizeof(result) ||
+	    !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    sprintf(msg, "worker for %s died", tracefiles[tracenum[j]]);
+	    malloc_error(tracenum[j], 0, msg);
+	    memset(&result, 0, sizeof(result));
+	}
+	stats[tracenum[j]] = result.stats;
+	errors += result.errors;
+	close(fds[j]);
+	pids[j] = 0;
+	running--;
+    }
+}
 
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
@@ -619,6 +929,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remember region */
 	    trace->blocks[index] = p;
 	    trace->block_sizes[index] = size;
+	    if (check_interval > 0 && !check_heap(tracenum, i, p))
+		return 0;
 	    break;
 
         case REALLOC: /* mm_realloc */
@@ -645,7 +957,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -656,6 +968,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    /* Remember region */
 	    trace->blocks[index] = newp;
 	    trace->block_sizes[index] = size;
+	    if (check_interval > 0 && !check_heap(tracenum, i, newp))
+		return 0;
 	    break;
 
         case FREE: /* mm_free */
@@ -664,6 +978,8 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    p = trace->blocks[index];
 	    remove_range(ranges, p);
 	    mm_free(p);
+	    if (check_interval > 0 && !check_heap(tracenum, i, NULL))
+		return 0;
 	    break;
 
 	default:
@@ -676,6 +992,24 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     return 1;
 }
 
+/*
+ * check_heap - After operation opnum, which returned bp (NULL for a
+ *     free), check the blocks it touched, and every check_interval
+ *     operations the whole heap. Returns 0 if mm.c found a problem.
+ */
+static int check_heap(int tracenum, int opnum, void *bp)
+{
+    if (mm_checkop(bp) != 0) {
+	malloc_error(tracenum, opnum, "mm_checkop found a bad block");
+	return 0;
+    }
+    if ((opnum + 1) % check_interval == 0 && mm_checkheap(0) != 0) {
+	malloc_error(tracenum, opnum, "mm_checkheap found a bad heap");
+	return 0;
+    }
+    return 1;
+}
+
 /* 
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for 
@@ -766,7 +1100,68 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    /* The heap may have shrunk since, so compare against its peak */
+    return ((double)max_total_size / (double)mem_peak_heapsize());
+}
+
+
+/*
+ * eval_mm_frag - Replay the trace once more and, every interval ops and
+ *    after the last one, append a snapshot of the heap layout to csv:
+ *    where the heap bytes went (payload, internal fragmentation in the
+ *    allocated blocks, parked, free, free slab slots, other), how split
+ *    up the free space is, and a histogram of free block sizes.
+ */
+static void eval_mm_frag(trace_t *trace, char *name, FILE *csv, int interval)
+{
+    int i, k, index;
+    size_t payload = 0, internal;
+    mm_layout_t l;
+    char *p;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+	app_error("mm_init failed in eval_mm_frag");
+
+    for (i = 0; i < trace->num_ops; i++) {
+	index = trace->ops[i].index;
+	switch (trace->ops[i].type) {
+	case ALLOC:
+	    if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc failed in eval_mm_frag");
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    payload += trace->ops[i].size;
+	    break;
+	case REALLOC:
+	    if ((p = mm_realloc(trace->blocks[index], trace->ops[i].size)) == NULL)
+		app_error("mm_realloc failed in eval_mm_frag");
+	    trace->blocks[index] = p;
+	    payload += trace->ops[i].size - trace->block_sizes[index];
+	    trace->block_sizes[index] = trace->ops[i].size;
+	    break;
+	case FREE:
+	    mm_free(trace->blocks[index]);
+	    payload -= trace->block_sizes[index];
+	    break;
+	default:
+	    app_error("Nonexistent request type in eval_mm_frag");
+	}
+	if ((i + 1) % interval != 0 && i != trace->num_ops - 1)
+	    continue;
+
+	mm_layout(&l);
+	internal = l.alloc_bytes - l.parked_bytes - payload;
+	fprintf(csv, "%s,%d,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%.4f,%.4f",
+		name, i + 1, l.heap_bytes, payload, internal, l.parked_bytes,
+		l.free_bytes, l.slot_free_bytes, l.other_bytes, l.free_blocks,
+		l.largest_free, l.alloc_bytes,
+		l.heap_bytes ? (double)payload / l.heap_bytes : 1.0,
+		l.free_bytes ? 1.0 - (double)l.largest_free / l.free_bytes : 0.0);
+	for (k = 0; k < MM_LAYOUT_BINS; k++)
+	    fprintf(csv, ",%zu", l.free_hist[k]);
+	fprintf(csv, "\n");
+    }
 }
 
 
@@ -964,6 +1359,151 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printtradeoff - prints the utilization and throughput of two runs of
+ *     the mm package side by side, eager coalescing first
+ */
+static void printtradeoff(int n, stats_t *eager, stats_t *deferred)
+{
+    int i;
+    double util[2] = {0, 0}, ops[2] = {0, 0}, secs[2] = {0, 0};
+    int width[2] = {14, 11}; /* util column widths, to line up with the header */
+    stats_t *run[2];
+    int r;
+
+    run[0] = eager;
+    run[1] = deferred;
+    printf("%5s%12s%8s%12s%8s\n", "trace", "eager util", "Kops",
+	   "defer util", "Kops");
+    for (i=0; i < n; i++) {
+	printf("%2d", i);
+	for (r = 0; r < 2; r++) {
+	    if (run[r][i].valid) {
+		printf("%*.0f%%%8.0f", width[r], run[r][i].util*100.0,
+		       (run[r][i].ops/1e3)/run[r][i].secs);
+		util[r] += run[r][i].util;
+		ops[r] += run[r][i].ops;
+		secs[r] += run[r][i].secs;
+	    }
+	    else
+		printf("%*s%8s", width[r] + 1, "-", "-");
+	}
+	printf("\n");
+    }
+    if (errors == 0)
+	printf("Total%11.0f%%%8.0f%11.0f%%%8.0f\n",
+	       (util[0]/n)*100.0, (ops[0]/1e3)/secs[0],
+	       (util[1]/n)*100.0, (ops[1]/1e3)/secs[1]);
+}
+
+/*
+ * printcounters - prints the events per request that the -C counters
+ *     saw while running each trace, and over all traces
+ */
+static void printcounters(int n, stats_t *stats)
+{
+    double sum[PERF_EVENTS], ops[PERF_EVENTS];
+    int i, j;
+
+    printf("%5s", "trace");
+    for (j = 0; j < PERF_EVENTS; j++)
+	printf("%12s", perf_names[j]);
+    printf("%7s\n", "IPC");
+    for (j = 0; j < PERF_EVENTS; j++)
+	sum[j] = ops[j] = 0;
+
+    for (i = 0; i < n; i++) {
+	printf("%2d   ", i);
+	for (j = 0; j < PERF_EVENTS; j++) {
+	    if (!stats[i].valid || stats[i].counts[j] < 0) {
+		printf("%12s", "-");
+		continue;
+	    }
+	    printf("%12.3f", stats[i].counts[j] / stats[i].ops);
+	    sum[j] += stats[i].counts[j];
+	    ops[j] += stats[i].ops;
+	}
+	if (stats[i].valid && stats[i].counts[PERF_CYCLES] > 0 &&
+	    stats[i].counts[PERF_INSTRUCTIONS] >= 0)
+	    printf("%7.2f\n", stats[i].counts[PERF_INSTRUCTIONS] /
+		   stats[i].counts[PERF_CYCLES]);
+	else
+	    printf("%7s\n", "-");
+    }
+
+    printf("%-5s", "Total");
+    for (j = 0; j < PERF_EVENTS; j++) {
+	if (ops[j] > 0)
+	    printf("%12.3f", sum[j] / ops[j]);
+	else
+	    printf("%12s", "-");
+    }
+    if (sum[PERF_CYCLES] > 0 && ops[PERF_INSTRUCTIONS] > 0)
+	printf("%7.2f\n", sum[PERF_INSTRUCTIONS] / sum[PERF_CYCLES]);
+    else
+	printf("%7s\n", "-");
+}
+
+/*
+ * printinfo - prints the mm package's own statistics for the last run,
+ *     and how much memory the heap held at its peak and at the end
+ */
+static void printinfo(void)
+{
+    mm_info_t info;
+    unsigned long small;
+
+    mm_info(&info);
+    small = info.tcache_hits + info.tcache_misses;
+    if (small > 0)
+	printf("Thread cache: %lu hits, %lu misses (%.1f%% hit rate), "
+	       "%lu blocks flushed\n",
+	       info.tcache_hits, info.tcache_misses,
+	       100.0 * info.tcache_hits / small, info.tcache_flushes);
+    if (info.slab_allocs > 0)
+	printf("Slab runs: %lu slot allocations from %lu runs\n",
+	       info.slab_allocs, info.slab_runs);
+    if (info.quick_hits + info.quick_sweeps > 0)
+	printf("Quick bins: %lu hits, %lu sweeps\n",
+	       info.quick_hits, info.quick_sweeps);
+    printf("Heap: %.1f KB peak, %.1f KB at end, %.1f KB resident, "
+	   "%.1f KB discarded\n",
+	   mem_peak_heapsize() / 1024.0, mem_heapsize() / 1024.0,
+	   mem_resident() / 1024.0, mem_discarded_bytes() / 1024.0);
+    printf("Regions: %lu KB each, %s\n", (unsigned long)(mem_maxheap() >> 10),
+	   heap_pages == MEM_PAGES_HUGETLB ? "huge pages" :
+	   heap_pages == MEM_PAGES_THP ? "transparent huge pages" :
+	   "base pages");
+}
+
+/*
+ * parse_size - Parse a byte count with an optional K, M or G suffix;
+ *     returns 0 if it is malformed
+ */
+static size_t parse_size(char *s)
+{
+    char *end;
+    unsigned long long n;
+    int shift = 0;
+
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'G': case 'g':
+	shift += 10;
+	/* fall through */
+    case 'M': case 'm':
+	shift += 10;
+	/* fall through */
+    case 'K': case 'k':
+	shift += 10;
+	end++;
+    }
+    if (end == s || *end != '\0' || errno == ERANGE || n > SIZE_MAX >> shift)
+	return 0;
+    return (size_t)n << shift;
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -996,14 +1536,30 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValsxLC] [-f <file>] [-t <dir>] [-d <bytes>] [-c <n>] [-T <n>]\n");
+    fprintf(stderr, "               [-F <csv> [-i <n>]] [-j <n>] [-H <size>] [-P thp|huge]\n");
+    fprintf(stderr, "               [-A best|addr|lifo|bump]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-A <pol>   Placement policy of mm: best, addr, lifo or bump.\n");
+    fprintf(stderr, "\t-C         Count hardware events per request (instructions, misses).\n");
+    fprintf(stderr, "\t-c <n>     Check the heap after each op, all of it every <n> ops.\n");
+    fprintf(stderr, "\t-d <bytes> Compare with deferred coalescing, <bytes> in quick bins.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t-F <csv>   Write heap layout snapshots of mm to <csv>.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <size>  Size of each heap region, at most 4G (default: 20M).\n");
+    fprintf(stderr, "\t-i <n>     With -F, snapshot every <n> ops (default: 100 per trace).\n");
+    fprintf(stderr, "\t-j <n>     Evaluate up to <n> traces at once, each on its own CPU.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print per-request latencies of libc and mm.\n");
+    fprintf(stderr, "\t-P thp     Back the heap with transparent huge pages.\n");
+    fprintf(stderr, "\t-P huge    Back the heap with huge pages from the hugetlbfs pool.\n");
+    fprintf(stderr, "\t-s         With -T, split each trace across the threads.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-x         With -T, split each trace and free blocks on another thread.\n");
+    fprintf(stderr, "\t-T <n>     Replay on up to <n> threads against libc and mm.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
 }
@@ -2,7 +2,42 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            The model reserves MAX_REGIONS regions of mem_max_heap
+ *            bytes each (MAX_HEAP unless the driver asks for another
+ *            size), back to back. Only region 0 is used by default; it
+ *            is the classic heap that mem_sbrk grows. A multi-arena
+ *            allocator can enable more regions, each with its own
+ *            break, so that arenas grow independently without sharing
+ *            (and locking) one brk pointer.
+ *
+ *            The regions are one inaccessible mapping that only
+ *            reserves address space; a region's pages are committed
+ *            (made readable and writable) MEM_COMMIT bytes at a time as
+ *            its break grows over them, and are only backed by memory
+ *            once touched. A heap of gigabytes therefore costs nothing
+ *            until it is used, and a stray access past the break of a
+ *            region faults instead of landing in the next one. The
+ *            mapping can be backed by transparent huge pages (the
+ *            kernel is asked to use them, and the regions are aligned
+ *            so it can) or by explicit huge pages from the hugetlbfs
+ *            pool (see /proc/sys/vm/nr_hugepages), which are mapped
+ *            over the reservation as it is committed.
+ *
+ *            Like a real break, a region can be shrunk again, which
+ *            gives the whole pages above the new break back to the
+ *            system, and the pages of memory that the allocator no
+ *            longer needs can be discarded in place (mem_discard). The model records the
+ *            peak heap size so that utilization is still measured
+ *            against the largest footprint of the run.
+ *
+ *            Huge blocks can bypass the regions altogether: mem_map
+ *            hands out page-aligned mappings of their own, which count
+ *            towards the heap size until mem_unmap returns them. The
+ *            model keeps a list of live mappings so that mem_in_heap
+ *            accepts payloads inside them.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +49,97 @@
 #include "memlib.h"
 #include "config.h"
 
+#define MEM_COMMIT (1 << 21) /* pages committed at once, 2 MB */
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static size_t mem_max_heap;  /* size of each region */
+static size_t mem_reserved;  /* length of the mapping holding the regions */
+static size_t mem_unit;      /* commit granularity, a multiple of pages */
+static int mem_pages;        /* MEM_PAGES_xxx backing of the regions */
+
+static int mem_nregions;                  /* number of regions in use */
+static char *mem_region_brk[MAX_REGIONS]; /* break of each region */
+static char *mem_region_top[MAX_REGIONS]; /* end of its committed pages */
+static char *mem_region_peak[MAX_REGIONS]; /* highest break since reset */
+static size_t mem_size;                   /* current heap size */
+static size_t mem_peak;                   /* largest heap size since reset */
+static size_t mem_discarded;              /* bytes passed to madvise */
+
+/* live mappings made by mem_map, guarded by a spin lock */
+typedef struct mem_map_t {
+    char *lo;                /* first byte of the mapping */
+    size_t len;              /* length, a multiple of the page size */
+    struct mem_map_t *next;
+} mem_map_t;
+static mem_map_t *mem_maps;
+static char mem_maps_lock;
+
+static int mem_commit(char *p, size_t len);
+static size_t mem_release(char *lo, char *hi, size_t page);
+static size_t mem_heap_page(void);
+static void mem_grow(long incr);
+static void mem_lock_maps(void);
+static void mem_unlock_maps(void);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_init_sized(MAX_HEAP, MEM_PAGES_SMALL);
+}
+
+/*
+ * mem_init_sized - initialize the memory system model with regions of
+ *    max_heap bytes (rounded up to MEM_COMMIT, or to the huge page size
+ *    if that is larger) backed by the given kind of pages
+ */
+void mem_init_sized(size_t max_heap, int pages)
+{
+    size_t huge, len, lead;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    char *p;
+    int r;
+
+    mem_unit = MEM_COMMIT;
+    if (pages != MEM_PAGES_SMALL && (huge = mem_hugepagesize()) > mem_unit)
+	mem_unit = huge;
+    mem_max_heap = 0;
+    if (max_heap <= MAX_HEAP_SPAN / MAX_REGIONS)
+	mem_max_heap = (max_heap + mem_unit - 1) / mem_unit * mem_unit;
+    if (mem_max_heap == 0 || mem_max_heap > MAX_HEAP_SPAN / MAX_REGIONS ||
+	mem_max_heap > (size_t)-1 / (MAX_REGIONS + 1)) {
+	fprintf(stderr, "mem_init_vm: heap size %lu out of range\n",
+		(unsigned long)max_heap);
 	exit(1);
     }
+    mem_reserved = mem_max_heap * MAX_REGIONS;
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    /*
+     * reserve the address space we will use to model the available VM,
+     * one unit more so that the regions can start on a unit
+     */
+    len = mem_reserved + mem_unit;
+    if ((p = mmap(NULL, len, PROT_NONE, flags, -1, 0)) == MAP_FAILED) {
+	perror("mem_init_vm: mmap");
+	exit(1);
+    }
+    lead = (mem_unit - (size_t)p % mem_unit) % mem_unit;
+    if (lead > 0)
+	munmap(p, lead);
+    munmap(p + lead + mem_reserved, mem_unit - lead);
+    p += lead;
+    if (pages == MEM_PAGES_THP && madvise(p, mem_reserved, MADV_HUGEPAGE) < 0) {
+	perror("mem_init_vm: madvise(MADV_HUGEPAGE)");
+	exit(1);
+    }
+    mem_start_brk = p;
+    mem_pages = pages;
+
+    for (r = 0; r < MAX_REGIONS; r++)
+	mem_region_top[r] = (char *)mem_region_lo(r);
+    mem_reset_brk();                          /* heap is empty initially */
 }
 
 /* 
@@ -39,35 +147,317 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();
+    munmap(mem_start_brk, mem_reserved);
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ *    that only uses region 0
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    mem_map_t *m;
+
+    /* mappings the allocator did not give back die with the heap */
+    while ((m = mem_maps) != NULL) {
+	mem_maps = m->next;
+	munmap(m->lo, m->len);
+	free(m);
+    }
+    mem_nregions = 1;
+    mem_region_brk[0] = mem_region_peak[0] = mem_start_brk;
+    mem_size = mem_peak = mem_discarded = 0;
+}
+
+/*
+ * mem_init_regions - make regions 0..n-1 of the (empty) heap usable.
+ *    Returns 0 on success, -1 if n is out of range or the heap is not
+ *    empty.
+ */
+int mem_init_regions(int n)
+{
+    int i;
+
+    if (n < 1 || n > MAX_REGIONS || mem_heapsize() != 0)
+	return -1;
+
+    mem_nregions = n;
+    for (i = 0; i < n; i++)
+	mem_region_brk[i] = mem_region_peak[i] = mem_region_lo(i);
+    return 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap and returns the old break.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_region_sbrk(0, incr);
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk for region r. Regions never share a
+ *    break, so callers that own different regions may grow and
+ *    shrink them concurrently.
+ */
+void *mem_region_sbrk(int r, int incr)
+{
+    char *old_brk = mem_region_brk[r];
+    char *max_addr = (char *)mem_region_lo(r) + mem_max_heap;
+    char *top;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    if ((old_brk + incr) > max_addr) {
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    if ((old_brk + incr) < (char *)mem_region_lo(r)) {
+	errno = EINVAL;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap...\n");
+	return (void *)-1;
+    }
+    if (incr < 0)
+	/* the pages above the new break go back, but stay committed */
+	mem_release(old_brk + incr, old_brk, mem_heap_page());
+    if (old_brk + incr > mem_region_top[r]) {
+	/* commit the units the region grows into */
+	top = (char *)mem_region_lo(r) + (old_brk + incr -
+		(char *)mem_region_lo(r) + mem_unit - 1) / mem_unit * mem_unit;
+	if (mem_commit(mem_region_top[r], top - mem_region_top[r]) < 0) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+	    return (void *)-1;
+	}
+	mem_region_top[r] = top;
+    }
+    mem_region_brk[r] += incr;
+    if (mem_region_brk[r] > mem_region_peak[r])
+	mem_region_peak[r] = mem_region_brk[r];
+    mem_grow(incr);
     return (void *)old_brk;
 }
 
+/*
+ * mem_commit - make the len reserved bytes at p usable. Explicit huge
+ *    pages are mapped over the reservation, which takes them from the
+ *    pool right away, so that running out of them fails here rather
+ *    than with a SIGBUS when a page is first touched.
+ */
+static int mem_commit(char *p, size_t len)
+{
+    if (mem_pages != MEM_PAGES_HUGETLB)
+	return mprotect(p, len, PROT_READ | PROT_WRITE);
+    if (mmap(p, len, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB, -1, 0) ==
+	MAP_FAILED)
+	return -1;
+    return 0;
+}
+
+/*
+ * mem_grow - add incr bytes to the heap size and raise the peak. The
+ *    size is shared by all regions and mappings, so this is atomic.
+ */
+static void mem_grow(long incr)
+{
+    size_t size, peak;
+
+    size = __atomic_add_fetch(&mem_size, (size_t)incr, __ATOMIC_RELAXED);
+    peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+    while (size > peak &&
+	   !__atomic_compare_exchange_n(&mem_peak, &peak, size, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+static void mem_lock_maps(void)
+{
+    while (__atomic_test_and_set(&mem_maps_lock, __ATOMIC_ACQUIRE))
+	;
+}
+
+static void mem_unlock_maps(void)
+{
+    __atomic_clear(&mem_maps_lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * mem_map - create a mapping of len bytes outside the regions and
+ *    return its first byte, which is page aligned. len must be a
+ *    multiple of the page size. Returns (void *)-1 on failure.
+ */
+void *mem_map(size_t len)
+{
+    mem_map_t *m;
+    void *p;
+
+    if ((m = (mem_map_t *)malloc(sizeof(mem_map_t))) == NULL)
+	return (void *)-1;
+    p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+	     -1, 0);
+    if (p == MAP_FAILED) {
+	free(m);
+	fprintf(stderr, "ERROR: mem_map failed. Ran out of memory...\n");
+	return (void *)-1;
+    }
+    m->lo = (char *)p;
+    m->len = len;
+    mem_lock_maps();
+    m->next = mem_maps;
+    mem_maps = m;
+    mem_unlock_maps();
+    mem_grow((long)len);
+    return p;
+}
+
+/*
+ * mem_find_map - return the link that points at the mapping starting
+ *    at p, or NULL. The caller holds the lock.
+ */
+static mem_map_t **mem_find_map(void *p)
+{
+    mem_map_t **link;
+
+    for (link = &mem_maps; *link != NULL; link = &(*link)->next)
+	if ((*link)->lo == (char *)p)
+	    return link;
+    return NULL;
+}
+
+/*
+ * mem_unmap - return the mapping at p made by mem_map. Returns 0 on
+ *    success, -1 if p does not start a mapping.
+ */
+int mem_unmap(void *p)
+{
+    mem_map_t **link, *m;
+
+    mem_lock_maps();
+    if ((link = mem_find_map(p)) == NULL) {
+	mem_unlock_maps();
+	return -1;
+    }
+    m = *link;
+    *link = m->next;
+    mem_unlock_maps();
+
+    munmap(m->lo, m->len);
+    mem_grow(-(long)m->len);
+    free(m);
+    return 0;
+}
+
+/*
+ * mem_remap - resize the mapping at p to len bytes, a multiple of the
+ *    page size, keeping its contents. The mapping moves if it cannot
+ *    grow where it is. Returns its new first byte, or (void *)-1.
+ */
+void *mem_remap(void *p, size_t len)
+{
+    mem_map_t **link, *m;
+    void *newp;
+    size_t oldlen;
+
+    mem_lock_maps();
+    if ((link = mem_find_map(p)) == NULL) {
+	mem_unlock_maps();
+	return (void *)-1;
+    }
+    m = *link;
+    oldlen = m->len;
+    newp = mremap(m->lo, oldlen, len, MREMAP_MAYMOVE);
+    if (newp == MAP_FAILED) {
+	mem_unlock_maps();
+	return (void *)-1;
+    }
+    m->lo = (char *)newp;
+    m->len = len;
+    mem_unlock_maps();
+    mem_grow((long)len - (long)oldlen);
+    return newp;
+}
+
+/*
+ * mem_discard - tell the system that the contents of the len bytes at
+ *    p are no longer needed. The whole pages inside the range are
+ *    released and read back as zeros; they stay part of the heap.
+ */
+void mem_discard(void *p, size_t len)
+{
+    size_t n = mem_release((char *)p, (char *)p + len, mem_pagesize());
+
+    __atomic_add_fetch(&mem_discarded, n, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_release - give the whole pages of the given size inside [lo, hi)
+ *    back to the system; returns the number of bytes released
+ */
+static size_t mem_release(char *lo, char *hi, size_t page)
+{
+    lo = (char *)(((size_t)lo + page - 1) & ~(page - 1));
+    hi = (char *)((size_t)hi & ~(page - 1));
+    if (hi <= lo || madvise(lo, hi - lo, MADV_DONTNEED) < 0)
+	return 0;
+    return hi - lo;
+}
+
+/*
+ * mem_heap_page - size of the pages backing the regions; explicit huge
+ *    pages can only be released whole
+ */
+static size_t mem_heap_page(void)
+{
+    return mem_pages == MEM_PAGES_HUGETLB ? mem_unit : mem_pagesize();
+}
+
+/*
+ * mem_region_lo - return address of the first byte of region r
+ */
+void *mem_region_lo(int r)
+{
+    return (void *)(mem_start_brk + (size_t)r * mem_max_heap);
+}
+
+/*
+ * mem_region_of - return the region that address p falls into, or -1
+ *    if p is not inside the simulated heap
+ */
+int mem_region_of(void *p)
+{
+    char *cp = (char *)p;
+
+    if (cp < mem_start_brk || cp >= (char *)mem_region_lo(mem_nregions))
+	return -1;
+    return (cp - mem_start_brk) / mem_max_heap;
+}
+
+/*
+ * mem_in_heap - return 1 if the bytes [lo, hi] all lie within the part
+ *    of a single region that has been handed out by mem_region_sbrk,
+ *    or within a single live mapping
+ */
+int mem_in_heap(void *lo, void *hi)
+{
+    int r = mem_region_of(lo);
+    mem_map_t *m;
+    int found = 0;
+
+    if ((char *)hi < (char *)lo)
+	return 0;
+    if (r >= 0)
+	return (char *)hi < mem_region_brk[r];
+
+    mem_lock_maps();
+    for (m = mem_maps; m != NULL && !found; m = m->next)
+	found = (char *)lo >= m->lo && (char *)hi < m->lo + m->len;
+    mem_unlock_maps();
+    return found;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -77,19 +467,84 @@ void *mem_heap_lo()
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte in region 0
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem_region_brk[0] - 1);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over regions
+ *    and mappings
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return __atomic_load_n(&mem_size, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size since the last
+ *    mem_reset_brk
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_peak;
+}
+
+/*
+ * mem_discarded_bytes() - returns the number of bytes released through
+ *    mem_discard since the last mem_reset_brk
+ */
+size_t mem_discarded_bytes()
+{
+    return mem_discarded;
+}
+
+/*
+ * mem_resident_range - return the number of resident bytes among the
+ *    pages that overlap [lo, hi), or 0 if mincore fails
+ */
+static size_t mem_resident_range(char *lo, char *hi)
+{
+    size_t page = mem_pagesize();
+    size_t resident = 0, n, i;
+    unsigned char *vec;
+
+    if (hi <= lo)
+	return 0;
+    lo = (char *)((size_t)lo & ~(page - 1));
+    n = (hi - lo + page - 1) / page;
+    if ((vec = (unsigned char *)malloc(n)) == NULL)
+	return 0;
+    if (mincore(lo, hi - lo, vec) == 0)
+	for (i = 0; i < n; i++)
+	    if (vec[i] & 1)
+		resident += page;
+    free(vec);
+    return resident;
+}
+
+/*
+ * mem_resident() - returns the number of heap bytes currently backed by
+ *    physical pages, as reported by mincore. Each region is scanned up
+ *    to the highest break since the reset, so pages that stay resident
+ *    above a shrunk break still count.
+ */
+size_t mem_resident()
+{
+    size_t resident = 0;
+    mem_map_t *m;
+    int r;
+
+    for (r = 0; r < mem_nregions; r++)
+	resident += mem_resident_range((char *)mem_region_lo(r),
+				       mem_region_peak[r]);
+    mem_lock_maps();
+    for (m = mem_maps; m != NULL; m = m->next)
+	resident += mem_resident_range(m->lo, m->lo + m->len);
+    mem_unlock_maps();
+    return resident;
 }
 
 /*
@@ -99,3 +554,30 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_maxheap() - returns the size of each heap region
+ */
+size_t mem_maxheap()
+{
+    return mem_max_heap;
+}
+
+/*
+ * mem_hugepagesize() - returns the default huge page size of the
+ *    system, from /proc/meminfo, or 2 MB if it is not listed there
+ */
+size_t mem_hugepagesize()
+{
+    char line[128];
+    unsigned long kb = 0;
+    FILE *f;
+
+    if ((f = fopen("/proc/meminfo", "r")) != NULL) {
+	while (fgets(line, sizeof(line), f) != NULL)
+	    if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+		break;
+	fclose(f);
+    }
+    return kb > 0 ? (size_t)kb << 10 : (size_t)MEM_COMMIT;
+}
@@ -1,10 +1,36 @@
 #include <unistd.h>
 
+/* Backing of the heap regions, for mem_init_sized */
+#define MEM_PAGES_SMALL   0 /* base pages */
+#define MEM_PAGES_THP     1 /* transparent huge pages */
+#define MEM_PAGES_HUGETLB 2 /* explicit huge pages, from the hugetlbfs pool */
+
 void mem_init(void);               
+void mem_init_sized(size_t max_heap, int pages);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
 size_t mem_pagesize(void);
+size_t mem_hugepagesize(void);
+size_t mem_maxheap(void);
+
+/* Returning memory: shrink with a negative sbrk, or discard pages */
+void mem_discard(void *p, size_t len);
+size_t mem_discarded_bytes(void);
+size_t mem_resident(void);
+
+/* Mappings outside the regions, for huge blocks */
+void *mem_map(size_t len);
+int mem_unmap(void *p);
+void *mem_remap(void *p, size_t len);
+
+/* Independent regions for multi-arena allocators */
+int mem_init_regions(int n);
+void *mem_region_sbrk(int r, int incr);
+void *mem_region_lo(int r);
+int mem_region_of(void *p);
+int mem_in_heap(void *lo, void *hi);
@@ -1,22 +1,213 @@
 /*
- * mm-naive.c - The fastest, least memory-efficient malloc package.
- * 
- * In this naive approach, a block is allocated by simply incrementing
- * the brk pointer.  A block is pure payload. There are no headers or
- * footers.  Blocks are never coalesced or reused. Realloc is
- * implemented directly using mm_malloc and mm_free.
+ * mm.c - Boundary-tag allocator with segregated explicit free lists.
  *
- * NOTE TO STUDENTS: Replace this header comment with your own header
- * comment that gives a high level description of your solution.
+ * Every block starts with a 4-byte header that packs the block size
+ * (a multiple of ALIGNMENT) with flag bits: bit 0 says whether the block
+ * itself is allocated, bit 1 says whether the block in front of it is,
+ * and bit 2 marks a huge block that lives in a mapping of its own.
+ * Only free blocks carry a footer; since coalesce() reads the
+ * prev-alloc bit first, it only ever follows the footer of a block that
+ * is known to be free. Allocated blocks therefore give the whole rest
+ * of the block to the payload:
+ *
+ *     allocated: | header | payload ......................... |
+ *     free:      | header | pred | succ | ...... | footer |
+ *
+ * ALIGNMENT is 8 on 32-bit builds and 16 on LP64 builds. The links
+ * are 32-bit offsets from the start of the heap, counted in ALIGNMENT
+ * units, rather than raw pointers. A free block therefore fits in the
+ * 16-byte minimum block on both kinds of build, and an LP64 heap can
+ * still grow far past 4GB, up to the 64GB that all memlib regions may
+ * span (MAX_HEAP_SPAN). Offset 0 is the NULL link; it can never name a
+ * block because the list heads live there.
+ *
+ * Free blocks smaller than TREE_MIN are kept in SEG_LISTS size
+ * classes. The class boundaries come from sizeclass.h, which the
+ * sizeclass tool generates from the request sizes in the traces so that
+ * each class sees about the same share of requests. Its lookup table
+ * is copied into every arena header, one byte per 16 bytes of block
+ * size, so finding the class of a size is a single load. Each class is
+ * sorted by size, so the first block that fits inside a class is also
+ * the best fit for that class.
+ *
+ * Free blocks of TREE_MIN bytes and more live in a single splay tree
+ * ordered by (size, address). The same two payload words serve as the
+ * left and right child links, so tree nodes need no extra room. A
+ * best-fit lookup splays the smallest key not below (asize, 0) to the
+ * root, which costs O(log n) amortized no matter how many large free
+ * blocks there are, and the address tie-break keeps every key unique.
+ *
+ * The class heads and the tree root are stored as offsets at the very
+ * bottom of the heap, in front of the prologue block:
+ *
+ *     | heads[0..SEG_LISTS-1] | root | pad | prologue | blocks ... | epilogue |
+ *
+ * find_fit() starts at the class of the request and only ever looks
+ * at free blocks; place(), coalesce() and extend_heap() keep the lists
+ * and the tree consistent with the block headers.
+ *
+ * How blocks under TREE_MIN are placed can be chosen with mm_mallopt
+ * (MM_OPT_PLACE), and takes effect at the next mm_init. The default
+ * keeps the classes sorted by size, as above, for a best fit.
+ * MM_PLACE_ADDR sorts them by address, so a request takes the lowest
+ * fitting block of the first class that has one and the heap fills
+ * from the bottom.
+ * MM_PLACE_LIFO pushes freed blocks on the front of their class, so a
+ * request reuses the most recently freed block that fits, which is the
+ * one most likely to still be in the cache. MM_PLACE_BUMP keeps the
+ * classes sorted by size but, when a request finds nothing in its own
+ * class, carves it from the front of a bump run that belongs to that
+ * class instead of splitting whatever larger block find_fit returns:
+ * a run of BUMP_BLOCKS blocks of the request's size, marked allocated
+ * while it waits, so blocks of one class allocated together also lie
+ * together. A run too small for the next request is freed. Runs are
+ * only cut from free blocks that can hold them, never from fresh heap;
+ * when no free block is big enough, the request is placed as usual.
+ *
+ * The heads, the root and the prologue together form an arena. Built
+ * with MM_THREADS=1, the allocator splits the simulated heap into
+ * MM_ARENAS memlib regions and runs one arena at the bottom of each.
+ * Every thread is bound round-robin to a home arena on its first call
+ * and allocates from it under that arena's mutex; there is no global
+ * lock. A block freed by a thread other than its owner is pushed onto
+ * the owning arena's lock-free remote-free stack, and the owner drains
+ * that stack the next time it takes its own lock. The block's region
+ * tells which arena owns it. All list code works on the thread-local
+ * `arena` pointer, so the single-threaded build is the same code with
+ * one arena and no locking.
+ *
+ * In front of the arenas sits a per-thread cache (MM_TCACHE). mm_free
+ * parks blocks of up to TCACHE_MAX bytes in a bin for their exact size,
+ * still marked allocated and linked through their first payload word,
+ * and mm_malloc pops them again without locking, splitting or
+ * coalescing anything. A bin holds at most TCACHE_COUNT blocks; when it
+ * is full, half of it is flushed back to the arena in one batch. The
+ * bins live in a control block that each thread allocates from its
+ * home arena, and an exiting thread flushes them.
+ *
+ * Requests of up to SLAB_MAX bytes skip the boundary tags altogether
+ * (MM_SLAB). Each arena owns a second memlib region that it carves into
+ * RUN_SIZE-byte runs; a run serves a single size class of headerless
+ * ALIGNMENT-multiple slots and records which of them are free in a bitmap
+ * in its own header:
+ *
+ *     | class | nfree | next | prev | bitmap[RUN_MAP_WORDS] | slots ... |
+ *
+ * Runs with free slots hang off per-class lists in the arena header,
+ * so allocating is a bitmap scan of the first run and freeing sets one
+ * bit. Slab regions sit above all arena regions, which makes "is this a
+ * slot?" a single address compare, and rounding the address down to
+ * RUN_SIZE finds the run header. A run that empties completely goes to
+ * the arena's list of empty runs and can be reused by any class.
+ *
+ * Freed memory also goes back to the system (MM_TRIM). When the free
+ * block ending an arena exceeds TOP_PAD by at least TRIM_MIN bytes, the
+ * arena's break is moved down until TOP_PAD bytes of it are left, so
+ * the next allocations need not grow the heap again. Otherwise, if the
+ * merged block spans at least RELEASE_MIN bytes, the freed block keeps
+ * its place in the heap and, once the arena already keeps RELEASE_PAD
+ * bytes of such blocks resident, memlib discards the whole pages
+ * between its links and its footer. Allocating from a block of at
+ * least RELEASE_MIN bytes counts as reusing kept memory and lowers the
+ * count again. Only the freed block is discarded, not the free
+ * neighbors it merged with, which were already handled when they were
+ * freed; so each free costs at most one discard of its own memory.
+ * The pads matter: discarding every large free and trimming to
+ * CHUNKSIZE halved the throughput of random-bal, since the pages were
+ * faulted back in by the very next allocations.
+ *
+ * Requests of MM_MMAP_MIN bytes and more never touch the arenas. Each
+ * gets a page-aligned memlib mapping with the payload ALIGNMENT bytes in,
+ * so the usual header sits right in front of it; the header holds the
+ * mapping length and the MAPPED bit. mm_free unmaps such a block,
+ * mm_realloc resizes the mapping (which may move it), and no arena
+ * lock is taken for either.
+ *
+ * Coalescing can also be deferred at run time with mm_mallopt
+ * (MM_OPT_DEFER). Freed blocks of up to QUICK_MAX bytes then stay
+ * marked allocated in per-arena quick bins of one exact size each, and
+ * a request of that size takes one back without splitting anything.
+ * The bins are swept, which frees and coalesces every block in them,
+ * once they hold more than the configured number of bytes or when no
+ * free block fits a request.
+ *
+ * Built with MM_HARDEN=1, every allocated block that has a header also
+ * carries a canary in the word where its footer would go: a keyed hash
+ * of its address and size. mm_free and mm_realloc check the allocated
+ * bit and the canary before touching the block and abort on a double
+ * free, a misaligned or foreign pointer, or a block whose header or
+ * tail was written over; a slot is checked against its run's bitmap
+ * instead. Freeing inverts the canary, so a block that is parked
+ * while still marked allocated is recognized as freed too. With
+ * MM_QUARANTINE bytes, freed blocks also wait in a per-arena FIFO and
+ * are only really freed once that many bytes were freed after them,
+ * which delays their reuse; the thread cache is off in that build.
+ *
+ * mm_checkheap walks every arena and cross-checks blocks, lists, tree,
+ * bins and runs. mm_checkop looks only at the block the last operation
+ * returned and the free block its last free coalesced into, with their
+ * neighbors and links, so it can run after every operation.
  */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
 
 #include "mm.h"
 #include "memlib.h"
+#include "sizeclass.h"
+
+/*
+ * Build options: MM_THREADS=1 builds the thread-safe multi-arena
+ * allocator (link with -pthread), MM_ARENAS sets its number of arenas.
+ * MM_TCACHE=0 removes the per-thread cache of small free blocks,
+ * MM_SLAB=0 removes the slab runs for the smallest requests,
+ * MM_TRIM=0 keeps all memory the heap has grown to, and MM_MMAP_MIN
+ * sets the request size from which blocks are mapped directly (0 turns
+ * that path off). MM_HARDEN=1 guards every block with a canary and
+ * aborts on double frees and corrupted blocks; MM_QUARANTINE sets how
+ * many bytes of freed blocks each arena holds back before reusing them.
+ */
+#ifndef MM_THREADS
+#define MM_THREADS 0
+#endif
+#ifndef MM_ARENAS
+#define MM_ARENAS 4
+#endif
+#ifndef MM_TCACHE
+#define MM_TCACHE 1
+#endif
+#ifndef MM_SLAB
+#define MM_SLAB 1
+#endif
+#ifndef MM_TRIM
+#define MM_TRIM 1
+#endif
+#ifndef MM_MMAP_MIN
+#define MM_MMAP_MIN (1 << 17)
+#endif
+#ifndef MM_HARDEN
+#define MM_HARDEN 0
+#endif
+#ifndef MM_QUARANTINE
+#define MM_QUARANTINE 0
+#endif
+/* 线程缓存会立即重用刚释放的块，与隔离相矛盾 */
+#if MM_QUARANTINE
+#undef MM_TCACHE
+#define MM_TCACHE 0
+#endif
+
+#if MM_THREADS
+#include <pthread.h>
+#define MM_TLS __thread
+#else
+#define MM_TLS
+#endif
 
 
 /*********************************************************
@@ -36,12 +227,21 @@ team_t team = {
     "None",
 };
 
+/* 能否由多个线程同时调用，供驱动程序的多线程重放判断 */
+const int mm_thread_safe = MM_THREADS;
+
+
+
 
-/* 单字4字节或双字8字节对齐 */
+/* 32 位构建按双字 8 字节对齐，LP64 构建按 16 字节对齐 */
+#ifdef __LP64__
+#define ALIGNMENT 16
+#else
 #define ALIGNMENT 8
+#endif
 
 /* 向上舍入到 ALIGNMENT 的最近倍数 */
-#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~0x7)
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
 
 
 #define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
@@ -50,10 +250,54 @@ team_t team = {
 #define WSIZE 4 /* 字和头部脚部大小 */
 #define DSIZE 8 /* 双字大小 */
 #define CHUNKSIZE (1 << 12) /* 按此大小扩展堆 */
+#define MIN_BLOCK (2 * DSIZE) /* 最小块：空闲时需容纳头部、两个链接和脚部 */
+/* 已分配块除载荷外占用的字节：头部，加固模式下还有金丝雀字 */
+#define OVERHEAD (MM_HARDEN ? DSIZE : WSIZE)
+#define TREE_MIN (1 << 10) /* 不小于此大小的空闲块放入伸展树 */
+#define SEG_LISTS SC_CLASSES /* 分离空闲链表的个数，覆盖 16 到 TREE_MIN-1 */
+#define SLAB_MAX 64 /* 不大于此大小的请求由槽满足 */
+#define SLAB_CLASSES (SLAB_MAX / ALIGNMENT) /* 槽大小为 ALIGNMENT 的各倍数 */
+#define RUN_SIZE (1 << 12) /* 每个运行块的大小，一页 */
+#define RUN_MAP_WORDS 16 /* 位图字数，足够覆盖最小一级的全部槽 */
+#define RUN_HDR ((4 + RUN_MAP_WORDS) * WSIZE) /* 运行块头部大小 */
+#define QUICK_MAX (1 << 9) /* 延迟合并时不大于此大小的块进入快速桶 */
+#define QUICK_BINS ((QUICK_MAX - MIN_BLOCK) / ALIGNMENT + 1)
+/* 快速桶状态在分配区头部中的起始字，位于槽分配器状态之后 */
+#define QUICK_WORD (SEG_LISTS + 1 + (MM_SLAB ? SLAB_CLASSES + 3 : 0))
+/* 隔离队列状态（队头、队尾和字节数）的起始字，位于快速桶状态之后 */
+#define QUAR_WORD (QUICK_WORD + QUICK_BINS + 3)
+/* 各大小类的碰撞分配运行块，位于隔离队列状态之后 */
+#define BUMP_WORD (QUAR_WORD + (MM_QUARANTINE ? 3 : 0))
+/* 留着未丢弃的大空闲块字节数，位于碰撞分配运行块之后 */
+#define KEEP_WORD (BUMP_WORD + SEG_LISTS)
+/* 大小类查找表在分配区头部中的起始字，每项一字节 */
+#define CLASS_WORD (KEEP_WORD + (MM_TRIM ? 1 : 0))
+/* 链表头、树根、槽分配器、快速桶状态和查找表所占的字数，取偶数以保持对齐 */
+#define HEAD_WORDS ((CLASS_WORD + SC_ENTRIES / WSIZE + 1) & ~1)
+#define TCACHE_MAX (1 << 8) /* 不大于此大小的块在释放时进入线程缓存 */
+#define TCACHE_COUNT 7 /* 线程缓存每个桶最多保留的块数 */
+/* 比它小的块留给槽分配器，不进入线程缓存 */
+#define TCACHE_MIN (MM_SLAB ? SLAB_MAX + ALIGNMENT : MIN_BLOCK)
+#define TRIM_MIN (1 << 17) /* 堆尾空闲块超出 TOP_PAD 的部分不小于此大小时收缩堆 */
+#define TOP_PAD (1 << 17) /* 收缩堆之后堆尾保留的空闲字节 */
+#define RELEASE_MIN (1 << 16) /* 空闲块不小于此大小时丢弃其内部的整页 */
+#define RELEASE_PAD (1 << 21) /* 每个分配区留着不丢弃、等待重用的大空闲块字节数 */
+#define BUMP_BLOCKS 16 /* 碰撞分配时每个运行块能容纳的请求块数 */
+
+/* 生成的查找表必须恰好覆盖分离空闲链表的大小范围 */
+#if (SC_ENTRIES << SC_SHIFT) != TREE_MIN
+#error "sizeclass.h does not match TREE_MIN; run make classes"
+#endif
 
 #define MAX(x, y) ((x) > (y)? (x) : (y))
+#define MIN(x, y) ((x) < (y)? (x) : (y))
 
-/* 将大小和已分配位打包到一个字中 */
+/* 头部中的标志位 */
+#define CUR_ALLOC 0x1 /* 本块已分配 */
+#define PREV_ALLOC 0x2 /* 前一个块已分配 */
+#define MAPPED 0x4 /* 本块独占一个映射，不属于任何分配区 */
+
+/* 将大小和标志位打包到一个字中 */
 #define PACK(size, alloc) ((size) | (alloc))
 
 /* 在地址 p 处读取和写入一个字 */
@@ -62,60 +306,347 @@ team_t team = {
 
 /* 从地址 p 读取大小和已分配字段 */
 #define GET_SIZE(p) (GET(p) & ~0x7)
-#define GET_ALLOC(p) (GET(p) & 0x1)
+#define GET_ALLOC(p) (GET(p) & CUR_ALLOC)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+
+/* 修改地址 p 处头部中的前块已分配位 */
+#define SET_PREV_ALLOC(p) PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p) PUT(p, GET(p) & ~PREV_ALLOC)
 
-/* 给定块指针 bp，计算其地址 */
+/* 给定块指针 bp，计算其头部和脚部地址，只有空闲块有脚部 */
 #define HDRP(bp) ((char *)(bp) - WSIZE)
 #define FTRP(bp) ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* 给定块指针 bp，计算下一个和上一个块的地址 */
+/* 给定块指针 bp，计算下一个和上一个块的地址，后者要求前一个块空闲 */
 #define NEXT_BLKP(bp) ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp) ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* 空闲块中前驱和后继链接所在的地址 */
+#define PRED_LINK(bp) ((char *)(bp))
+#define SUCC_LINK(bp) ((char *)(bp) + WSIZE)
+
+/*
+ * 指针与相对堆起点的偏移量互相转换，偏移量 0 表示 NULL。被链接的地址
+ * 都按 ALIGNMENT 对齐，所以偏移量以 ALIGNMENT 字节为单位，32 位的
+ * 链接在 LP64 构建中可以覆盖 64GB 的堆
+ */
+#define TO_OFF(p) \
+    ((p) ? (unsigned int)(((char *)(p) - heap_base) / ALIGNMENT) : 0)
+#define TO_PTR(off) ((off) ? heap_base + (size_t)(off) * ALIGNMENT : NULL)
+
+/* 给定空闲块指针 bp，读取其前驱和后继空闲块 */
+#define PRED(bp) TO_PTR(GET(PRED_LINK(bp)))
+#define SUCC(bp) TO_PTR(GET(SUCC_LINK(bp)))
+
+/* 树节点复用这两个字作为左右孩子链接 */
+#define LEFT_LINK(bp) PRED_LINK(bp)
+#define RIGHT_LINK(bp) SUCC_LINK(bp)
+#define LEFT(bp) PRED(bp)
+#define RIGHT(bp) SUCC(bp)
+
+/* 当前分配区中第 i 个分离空闲链表的表头地址，以及伸展树树根的地址 */
+#define SEG_HEAD(i) (arena + (i) * WSIZE)
+#define TREE_ROOT (arena + SEG_LISTS * WSIZE)
+
+/* 槽分配器状态：各级运行块链表头、空运行块链表头以及两个计数 */
+#define SLAB_HEAD(c) (arena + (SEG_LISTS + 1 + (c)) * WSIZE)
+#define SLAB_EMPTY (arena + (SEG_LISTS + 1 + SLAB_CLASSES) * WSIZE)
+#define SLAB_RUNS(a) ((a) + (SEG_LISTS + 2 + SLAB_CLASSES) * WSIZE)
+#define SLAB_ALLOCS(a) ((a) + (SEG_LISTS + 3 + SLAB_CLASSES) * WSIZE)
+
+/* 大小类查找表中块大小 size 对应的项 */
+#define CLASS_OF(size) \
+    (*(unsigned char *)(arena + CLASS_WORD * WSIZE + ((size) >> SC_SHIFT)))
+
+/* 快速桶：每种块大小一个链表头，之后是桶中总字节数和两个计数 */
+#define QUICK_HEAD(size) \
+    (arena + (QUICK_WORD + ((size) - MIN_BLOCK) / ALIGNMENT) * WSIZE)
+#define QUICK_BYTES(a) ((a) + (QUICK_WORD + QUICK_BINS) * WSIZE)
+#define QUICK_HITS(a) ((a) + (QUICK_WORD + QUICK_BINS + 1) * WSIZE)
+#define QUICK_SWEEPS(a) ((a) + (QUICK_WORD + QUICK_BINS + 2) * WSIZE)
+
+/* 第 c 个大小类当前的碰撞分配运行块 */
+#define BUMP_HEAD(c) (arena + (BUMP_WORD + (c)) * WSIZE)
+
+/* 留着未丢弃的大空闲块字节数 */
+#define KEEP_BYTES (arena + KEEP_WORD * WSIZE)
+
+/* 隔离队列：按释放顺序链接的块，以及队列中的总字节数 */
+#define QUAR_HEAD (arena + QUAR_WORD * WSIZE)
+#define QUAR_TAIL (arena + (QUAR_WORD + 1) * WSIZE)
+#define QUAR_BYTES (arena + (QUAR_WORD + 2) * WSIZE)
+
+/*
+ * 已分配块的金丝雀字位于空闲块脚部的位置；块被释放但仍标记为已分配
+ * （在线程缓存、快速桶或隔离队列中）时存放其按位取反的值
+ */
+#define CANARY(bp) FTRP(bp)
+#if MM_HARDEN
+#define GUARD_ARM(bp) guard_arm(bp)
+#else
+#define GUARD_ARM(bp) (bp)
+#endif
+
+/* 运行块头部各字段，以及第 c 级的槽大小和每个运行块的槽数 */
+#define RUN_CLASS(r) ((char *)(r))
+#define RUN_NFREE(r) ((char *)(r) + WSIZE)
+#define RUN_NEXT(r) ((char *)(r) + 2 * WSIZE)
+#define RUN_PREV(r) ((char *)(r) + 3 * WSIZE)
+#define RUN_MAP(r, i) ((char *)(r) + (4 + (i)) * WSIZE)
+#define SLOT_SIZE(c) (((c) + 1) * ALIGNMENT)
+#define RUN_SLOTS(c) ((RUN_SIZE - RUN_HDR) / SLOT_SIZE(c))
+
+/* 槽区域位于所有分配区区域之上；区域大小是 RUN_SIZE 的倍数 */
+#if MM_SLAB
+#define IS_SLAB(bp) ((char *)(bp) >= slab_base && (char *)(bp) < slab_end)
+#define RUN_OF(bp) (slab_base + (((char *)(bp) - slab_base) & ~(RUN_SIZE - 1)))
+#else
+#define IS_SLAB(bp) 0
+#endif
+
+/*
+ * 直接映射的块；槽没有头部，要先排除。不加锁读取头部是安全的：
+ * 块存活期间 MAPPED 位不变，属主分配区只会改动前块已分配位
+ */
+#define IS_MAPPED(bp) (!IS_SLAB(bp) && (GET(HDRP(bp)) & MAPPED))
+
+/* 线程缓存控制块：每种块大小一个桶，先是各桶链表头，再是各桶计数 */
+#define TC_BINS ((TCACHE_MAX - MIN_BLOCK) / ALIGNMENT + 1)
+#define TC_BIN(size) (tcache + ((size) - MIN_BLOCK) / ALIGNMENT * WSIZE)
+#define TC_COUNT(size) (TC_BIN(size) + TC_BINS * WSIZE)
+#define TC_SIZE (2 * TC_BINS * WSIZE)
+
+#if MM_THREADS
+/* 多分配区构建中，分配区头部在链表头之后还有所属区域、远程释放栈和锁 */
+#define ARENA_REGION(a) ((a) + HEAD_WORDS * WSIZE)
+#define ARENA_REMOTE(a) ((unsigned int *)((a) + (HEAD_WORDS + 1) * WSIZE))
+#define ARENA_LOCK(a) ((pthread_mutex_t *)((a) + (HEAD_WORDS + 2) * WSIZE))
+#define ARENA_SIZE ALIGN((HEAD_WORDS + 2) * WSIZE + sizeof(pthread_mutex_t))
+#define ARENA_SBRK(incr) mem_region_sbrk(GET(ARENA_REGION(arena)), (incr))
+#define SLAB_SBRK(incr) \
+    mem_region_sbrk(GET(ARENA_REGION(arena)) + MM_ARENAS, (incr))
+#define NUM_ARENAS MM_ARENAS
+#else
+#define ARENA_SIZE ALIGN(HEAD_WORDS * WSIZE)
+#define ARENA_SBRK(incr) mem_sbrk(incr)
+#define SLAB_SBRK(incr) mem_region_sbrk(1, (incr))
+#define NUM_ARENAS 1
+#endif
+
 static void *extend_heap(size_t words);
 static void *find_fit(size_t asize);
 static void place(void *bp, size_t asize);
+static int list_before(char *a, char *b);
+static void *bump_alloc(size_t asize);
 static void *coalesce(void *bp);
-
-static char *heap_listp;
-static char *pre_listp;
+static int seg_index(size_t size);
+static void insert_free(void *bp);
+static void remove_free(void *bp);
+static int tree_cmp(size_t size, char *addr, char *node);
+static char *tree_splay(char *t, size_t size, char *addr);
+static void tree_insert(void *bp);
+static void tree_remove(void *bp);
+static void *tree_fit(size_t asize);
+static size_t adjust_size(size_t size);
+static void shrink_block(void *bp, size_t asize);
+#if MM_TRIM
+static void release_free(char *bp, char *freed, size_t size);
+#endif
+static char *arena_init(int region);
+static void *arena_malloc(size_t size);
+static void arena_free(void *bp);
+static void free_block(void *bp);
+static void heap_free(void *bp);
+static void quick_sweep(void);
+static void *arena_realloc(void *ptr, size_t size);
+#if MM_SLAB
+static void run_push(char *head, char *run);
+static void run_remove(char *head, char *run);
+static char *run_create(int c);
+static void *slab_alloc(size_t size);
+static void slab_free(void *bp);
+#endif
+#if MM_MMAP_MIN
+static void *map_block(size_t size);
+static void unmap_block(void *bp);
+static void *map_realloc(void *ptr, size_t size);
+#endif
+#if MM_HARDEN
+static unsigned int guard_of(void *bp);
+static void *guard_arm(void *bp);
+static void guard_check(void *bp, char *fn);
+static void guard_fail(char *fn, char *what, void *bp);
+#endif
+static int check_error(void *bp, char *what);
+static void printblock(void *bp);
+static int check_link(char *bp, char *p);
+static int check_links(char *bp);
+static int check_block(char *bp);
+#if MM_SLAB
+static int check_run(char *run);
+static int check_slot(char *bp);
+static int check_slab(int region);
+#endif
+static long check_tree(char *t, char *lo, char *hi, int *errs);
+static size_t check_parked(char *bp, size_t size, int *errs);
+static int check_arena(int i, int verbose);
+static int check_touched(char *bp);
+#if MM_TCACHE
+static void *tcache_get(size_t size);
+static int tcache_put(void *bp);
+static void tcache_flush(size_t size, int n);
+#if MM_THREADS
+static void tcache_destroy(void *tc);
+#endif
+#endif
+
+static char *heap_base; /* 堆的第一个字节，链接偏移量的基准 */
+static char *heap_listp; /* 0 号分配区的序言块 */
+static MM_TLS char *arena; /* 当前操作的分配区，即其链表头数组 */
+static int defer_limit; /* 快速桶容量（字节），0 表示立即合并 */
+static int place_policy; /* 本次 mm_init 起使用的放置策略 */
+static int place_option; /* mm_mallopt 设置的放置策略，下次 mm_init 时生效 */
+static MM_TLS char *last_freed; /* 最近一次释放合并成的空闲块，供 mm_checkop 检查 */
+#if MM_HARDEN
+static unsigned int guard_key; /* 金丝雀的随机成分，每次 mm_init 重新选取 */
+#endif
+#if MM_SLAB
+static char *slab_base; /* 第一个槽区域的起点 */
+static char *slab_end; /* 最后一个槽区域之后的第一个字节 */
+#endif
+#if MM_THREADS
+static MM_TLS char *home_arena; /* 本线程固定使用的分配区 */
+static int next_arena; /* 下一个新线程将绑定的分配区编号 */
+#endif
+#if MM_TCACHE
+static MM_TLS char *tcache; /* 本线程的缓存控制块 */
+static MM_TLS unsigned long tc_hits, tc_misses, tc_flushes; /* 本线程的缓存统计 */
+#if MM_THREADS
+static pthread_key_t tc_key; /* 线程退出时借此清空其缓存 */
+static int tc_key_made;
+static unsigned long tc_done_hits, tc_done_misses, tc_done_flushes; /* 已退出线程的统计 */
+#endif
+#endif
 
 
+/*
+ * extend_heap - Grow the heap by the given number of words and return
+ *     the resulting free block, merged with a free tail if there is one.
+ */
 static void *extend_heap(size_t words)
 {
     char *bp;
     size_t size;
+    size_t prev_alloc;
 
     /* 分配字以保持对齐 */
-    size = (words % 2) ? (words+1) * WSIZE : words * WSIZE;
-    if ((long)(bp = mem_sbrk(size)) == -1)
+    size = ALIGN(words * WSIZE);
+    /* mem_sbrk 的参数是 int，更大的增量会被截断，甚至变成收缩 */
+    if (size > INT_MAX)
+        return NULL;
+    if ((long)(bp = ARENA_SBRK(size)) == -1)
         return NULL;
 
-    /* 初始化空闲块和结尾块 */
-
-    PUT(HDRP(bp), PACK(size, 0)); /* 空闲块头部 */
-    PUT(FTRP(bp), PACK(size, 0)); /* 空闲块脚部 */
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* 新的结尾块头部 */
+    /* 初始化空闲块和结尾块，旧结尾块头部记录着最后一个块的状态 */
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    PUT(HDRP(bp), PACK(size, prev_alloc)); /* 空闲块头部 */
+    PUT(FTRP(bp), PACK(size, prev_alloc)); /* 空闲块脚部 */
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, CUR_ALLOC)); /* 新的结尾块头部 */
 
-    /* 如果前一个块是空闲的，则合并 */
+    /* 如果前一个块是空闲的，则合并，并放入空闲链表 */
     return coalesce(bp);
 }
 
 
+/*
+ * arena_init - Create an empty arena at the bottom of heap region
+ *     region and make it the current arena. Returns its prologue block,
+ *     or NULL if the region has no room.
+ */
+static char *arena_init(int region)
+{
+    const unsigned char table[SC_ENTRIES] = SC_TABLE;
+    char *p;
+    int i;
+
+    /* 链表头数组和树根之后是序言块和结尾块 */
+#if MM_THREADS
+    if ((p = mem_region_sbrk(region, ARENA_SIZE + 4 * WSIZE)) == (void *)-1)
+        return NULL;
+#else
+    if ((p = mem_sbrk(ARENA_SIZE + 4 * WSIZE)) == (void *)-1)
+        return NULL;
+#endif
+    arena = p;
+    for (i = 0; i < HEAD_WORDS; i++)
+        PUT(arena + i * WSIZE, 0);
+    for (i = 0; i < SC_ENTRIES; i++)
+        CLASS_OF(i << SC_SHIFT) = table[i];
+#if MM_THREADS
+    PUT(ARENA_REGION(arena), region);
+    *ARENA_REMOTE(arena) = 0;
+    pthread_mutex_init(ARENA_LOCK(arena), NULL);
+#endif
+
+    p = arena + ARENA_SIZE;
+    PUT(p, 0); /* 对齐填充 */
+    PUT(p + (1 * WSIZE), PACK(DSIZE, PREV_ALLOC | CUR_ALLOC));
+    PUT(p + (2 * WSIZE), PACK(DSIZE, PREV_ALLOC | CUR_ALLOC));
+    PUT(p + (3 * WSIZE), PACK(0, PREV_ALLOC | CUR_ALLOC));
+    return p + (2 * WSIZE);
+}
+
+
 /*
  * mm_init - initialize the malloc package.
  */
 int mm_init(void)
 {
-    /* 创建初始空堆 */
-    if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
+    heap_base = mem_heap_lo();
+    place_policy = place_option;
+#if MM_HARDEN
+    guard_key = ((unsigned int)time(NULL) ^ (unsigned int)getpid() << 16) *
+        0x9E3779B1u;
+#endif
+
+    /* 每个分配区独占一个区域，开启槽分配器时再各配一个槽区域 */
+    if (mem_init_regions(MM_SLAB ? 2 * NUM_ARENAS : NUM_ARENAS) < 0)
+        return -1;
+    last_freed = NULL;
+#if MM_SLAB
+    slab_base = mem_region_lo(NUM_ARENAS);
+    slab_end = mem_region_lo(2 * NUM_ARENAS);
+#endif
+
+#if MM_THREADS
+    int i;
+
+    /* 其他分配区首次使用时才扩展 */
+    for (i = MM_ARENAS - 1; i >= 0; i--) {
+        if ((heap_listp = arena_init(i)) == NULL)
+            return -1;
+    }
+    home_arena = NULL;
+    next_arena = 0;
+#else
+    if ((heap_listp = arena_init(0)) == NULL)
         return -1;
-    PUT(heap_listp, 0); /* 对齐填充 */
-    PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1));
-    PUT(heap_listp + (3 * WSIZE), PACK(0, 1));
-    heap_listp += (2 * WSIZE);
-    pre_listp = heap_listp;
+#endif
+
+#if MM_TCACHE
+    /* 旧的缓存控制块随旧堆一起作废 */
+    tcache = NULL;
+    tc_hits = tc_misses = tc_flushes = 0;
+#if MM_THREADS
+    if (!tc_key_made) {
+        pthread_key_create(&tc_key, tcache_destroy);
+        tc_key_made = 1;
+    }
+    pthread_setspecific(tc_key, NULL);
+    tc_done_hits = tc_done_misses = tc_done_flushes = 0;
+#endif
+#endif
+
     /* 用 CHUNKSIZE 字节的空闲块扩展堆 */
     if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
         return -1;
@@ -123,56 +654,471 @@ int mm_init(void)
 }
 
 
-static void *find_fit(size_t asize)
+/*
+ * seg_index - Map a block size below TREE_MIN to its free list with
+ *     one lookup in the arena's copy of the generated class table.
+ */
+static int seg_index(size_t size)
 {
-    char *bp = pre_listp;
-    size_t alloc;
-    size_t size;
-    while (GET_SIZE(HDRP(NEXT_BLKP(bp))) > 0) {
-        bp = NEXT_BLKP(bp);
-        alloc = GET_ALLOC(HDRP(bp));
-        if (alloc) continue;
-        size = GET_SIZE(HDRP(bp));
-        if (size < asize) continue;
-        return bp;
+    return CLASS_OF(size);
+}
+
+
+/*
+ * insert_free - Link free block bp into its size class, in the order
+ *     of the placement policy, or into the tree if it is large.
+ */
+static void insert_free(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *head;
+    char *prev = NULL;
+    char *cur;
+
+    if (size >= TREE_MIN) {
+        tree_insert(bp);
+        return;
     }
-    bp = heap_listp;
-    while (bp != pre_listp) {
-        bp = NEXT_BLKP(bp);
-        alloc = GET_ALLOC(HDRP(bp));
-        if (alloc) continue;
-        size = GET_SIZE(HDRP(bp));
-        if (size < asize) continue;
-        return bp;
+
+    head = SEG_HEAD(seg_index(size));
+    cur = TO_PTR(GET(head));
+
+    /* 后进先出时直接放在表头，否则按大小或地址找到插入位置 */
+    while (cur != NULL && list_before(cur, bp)) {
+        prev = cur;
+        cur = SUCC(cur);
+    }
+
+    PUT(PRED_LINK(bp), TO_OFF(prev));
+    PUT(SUCC_LINK(bp), TO_OFF(cur));
+    if (prev != NULL)
+        PUT(SUCC_LINK(prev), TO_OFF(bp));
+    else
+        PUT(head, TO_OFF(bp));
+    if (cur != NULL)
+        PUT(PRED_LINK(cur), TO_OFF(bp));
+}
+
+
+/*
+ * list_before - Return whether free block a sorts before b in a size
+ *     class under the current placement policy
+ */
+static int list_before(char *a, char *b)
+{
+    switch (place_policy) {
+    case MM_PLACE_ADDR:
+        return a < b;
+    case MM_PLACE_LIFO:
+        return 0;
+    default:
+        return GET_SIZE(HDRP(a)) < GET_SIZE(HDRP(b));
+    }
+}
+
+
+/*
+ * remove_free - Unlink free block bp from its size class or the tree.
+ *     The header must still hold the size bp was inserted with.
+ */
+static void remove_free(void *bp)
+{
+    char *pred, *succ;
+
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+        tree_remove(bp);
+        return;
+    }
+
+    pred = PRED(bp);
+    succ = SUCC(bp);
+    if (pred != NULL)
+        PUT(SUCC_LINK(pred), GET(SUCC_LINK(bp)));
+    else
+        PUT(SEG_HEAD(seg_index(GET_SIZE(HDRP(bp)))), GET(SUCC_LINK(bp)));
+    if (succ != NULL)
+        PUT(PRED_LINK(succ), GET(PRED_LINK(bp)));
+}
+
+
+/*
+ * tree_cmp - Compare the key (size, addr) with the key of tree node
+ *     node; returns <0, 0 or >0 like strcmp.
+ */
+static int tree_cmp(size_t size, char *addr, char *node)
+{
+    size_t nsize = GET_SIZE(HDRP(node));
+
+    if (size != nsize)
+        return (size < nsize) ? -1 : 1;
+    if (addr != node)
+        return (addr < node) ? -1 : 1;
+    return 0;
+}
+
+
+/*
+ * tree_splay - Top-down splay of subtree t around key (size, addr).
+ *     Returns the new subtree root: the node with that key if there is
+ *     one, otherwise its predecessor or successor in key order.
+ */
+static char *tree_splay(char *t, size_t size, char *addr)
+{
+    char *lroot = NULL, *lmax = NULL; /* 左树：所有键都小于目标 */
+    char *rroot = NULL, *rmin = NULL; /* 右树：所有键都大于目标 */
+    char *y;
+    int cmp;
+
+    if (t == NULL)
+        return NULL;
+
+    while ((cmp = tree_cmp(size, addr, t)) != 0) {
+        if (cmp < 0) {
+            if ((y = LEFT(t)) == NULL)
+                break;
+            if (tree_cmp(size, addr, y) < 0) { /* 右旋 */
+                PUT(LEFT_LINK(t), GET(RIGHT_LINK(y)));
+                PUT(RIGHT_LINK(y), TO_OFF(t));
+                t = y;
+                if (LEFT(t) == NULL)
+                    break;
+            }
+            /* 把 t 挂到右树的最左端 */
+            if (rmin == NULL)
+                rroot = t;
+            else
+                PUT(LEFT_LINK(rmin), TO_OFF(t));
+            rmin = t;
+            t = LEFT(t);
+        }
+        else {
+            if ((y = RIGHT(t)) == NULL)
+                break;
+            if (tree_cmp(size, addr, y) > 0) { /* 左旋 */
+                PUT(RIGHT_LINK(t), GET(LEFT_LINK(y)));
+                PUT(LEFT_LINK(y), TO_OFF(t));
+                t = y;
+                if (RIGHT(t) == NULL)
+                    break;
+            }
+            /* 把 t 挂到左树的最右端 */
+            if (lmax == NULL)
+                lroot = t;
+            else
+                PUT(RIGHT_LINK(lmax), TO_OFF(t));
+            lmax = t;
+            t = RIGHT(t);
+        }
+    }
+
+    /* 重新组装：t 的两棵子树分别接到左右树上 */
+    if (lmax != NULL) {
+        PUT(RIGHT_LINK(lmax), GET(LEFT_LINK(t)));
+        PUT(LEFT_LINK(t), TO_OFF(lroot));
+    }
+    if (rmin != NULL) {
+        PUT(LEFT_LINK(rmin), GET(RIGHT_LINK(t)));
+        PUT(RIGHT_LINK(t), TO_OFF(rroot));
+    }
+    return t;
+}
+
+
+/*
+ * tree_insert - Add large free block bp to the tree and make it the root.
+ */
+static void tree_insert(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t = tree_splay(TO_PTR(GET(TREE_ROOT)), size, bp);
+
+    if (t == NULL) {
+        PUT(LEFT_LINK(bp), 0);
+        PUT(RIGHT_LINK(bp), 0);
+    }
+    else if (tree_cmp(size, bp, t) < 0) {
+        PUT(LEFT_LINK(bp), GET(LEFT_LINK(t)));
+        PUT(RIGHT_LINK(bp), TO_OFF(t));
+        PUT(LEFT_LINK(t), 0);
+    }
+    else {
+        PUT(RIGHT_LINK(bp), GET(RIGHT_LINK(t)));
+        PUT(LEFT_LINK(bp), TO_OFF(t));
+        PUT(RIGHT_LINK(t), 0);
     }
-    return NULL;
+    PUT(TREE_ROOT, TO_OFF(bp));
 }
 
 
+/*
+ * tree_remove - Remove large free block bp from the tree.
+ */
+static void tree_remove(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *t = tree_splay(TO_PTR(GET(TREE_ROOT)), size, bp);
+    char *x;
+
+    /* 此时 t == bp；左子树中最大的节点成为新根 */
+    if (LEFT(t) == NULL) {
+        PUT(TREE_ROOT, GET(RIGHT_LINK(t)));
+        return;
+    }
+    x = tree_splay(LEFT(t), size, bp);
+    PUT(RIGHT_LINK(x), GET(RIGHT_LINK(t)));
+    PUT(TREE_ROOT, TO_OFF(x));
+}
+
+
+/*
+ * tree_fit - Return the smallest free block in the tree with at least
+ *     asize bytes (lowest address on ties), or NULL if none is that big.
+ */
+static void *tree_fit(size_t asize)
+{
+    char *t = tree_splay(TO_PTR(GET(TREE_ROOT)), asize, NULL);
+
+    if (t == NULL)
+        return NULL;
+    PUT(TREE_ROOT, TO_OFF(t));
+    if (GET_SIZE(HDRP(t)) >= asize)
+        return t;
+
+    /* 根是目标的前驱，后继是右子树中最小的节点 */
+    if ((t = RIGHT(t)) == NULL)
+        return NULL;
+    while (LEFT(t) != NULL)
+        t = LEFT(t);
+    return t;
+}
+
+
+/*
+ * find_fit - Return the first free block of at least asize bytes in
+ *     the lowest class that has one, falling back to a best fit from
+ *     the tree, or NULL if no free block fits. Depending on the order
+ *     of the classes, that is the smallest, the lowest or the most
+ *     recently freed block of the class.
+ */
+static void *find_fit(size_t asize)
+{
+    char *bp;
+    int i;
+
+    if (asize < TREE_MIN) {
+        for (i = seg_index(asize); i < SEG_LISTS; i++) {
+            for (bp = TO_PTR(GET(SEG_HEAD(i))); bp != NULL; bp = SUCC(bp)) {
+                if (GET_SIZE(HDRP(bp)) >= asize)
+                    return bp;
+            }
+        }
+    }
+    bp = tree_fit(asize);
+#if MM_TRIM
+    /* 从大空闲块中分配就是在重用留着的内存，相应地减少留着的字节数 */
+    if (bp != NULL && GET_SIZE(HDRP(bp)) >= RELEASE_MIN)
+        PUT(KEEP_BYTES, GET(KEEP_BYTES) - MIN(GET(KEEP_BYTES), asize));
+#endif
+    return bp;
+}
+
+
+/*
+ * place - Allocate asize bytes at the start of free block bp, returning
+ *     the remainder to the free lists if it is big enough to split.
+ */
 static void place(void *bp, size_t asize)
 {
     size_t size = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    remove_free(bp);
+    if ((size - asize) >= MIN_BLOCK) {
+        PUT(HDRP(bp), PACK(asize, prev_alloc | CUR_ALLOC));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(size - asize, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size - asize, PREV_ALLOC));
+        insert_free(bp);
+    }
+
+    else {
+        PUT(HDRP(bp), PACK(size, prev_alloc | CUR_ALLOC));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    }
+}
 
-    if ((size - asize) >= (2 * DSIZE)) {
-        PUT(HDRP(bp), PACK(asize, 1));
-        PUT(FTRP(bp), PACK(asize, 1));
-        PUT(HDRP(NEXT_BLKP(bp)), PACK(size - asize, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size - asize, 0));
+
+/*
+ * bump_alloc - Carve a block of asize bytes, less than TREE_MIN, from
+ *     the front of the bump run of its class. A run too small for it
+ *     is freed and replaced by a new one cut from a free block. Returns
+ *     NULL if no free block can hold a new run.
+ */
+static void *bump_alloc(size_t asize)
+{
+    char *head = BUMP_HEAD(seg_index(asize));
+    char *run = TO_PTR(GET(head));
+    size_t size = BUMP_BLOCKS * asize;
+
+    if (run != NULL && GET_SIZE(HDRP(run)) < asize) {
+        PUT(head, 0);
+        free_block(run);
+        run = NULL;
     }
+    if (run == NULL) {
+        if ((run = find_fit(size)) == NULL)
+            return NULL;
+        place(run, size);
+    }
+
+    /* 运行块本身标记为已分配，切下的块同样如此，其余部分留作运行块 */
+    size = GET_SIZE(HDRP(run));
+    if (size - asize >= MIN_BLOCK) {
+        PUT(HDRP(run), PACK(asize, GET_PREV_ALLOC(HDRP(run)) | CUR_ALLOC));
+        PUT(head, TO_OFF(NEXT_BLKP(run)));
+        PUT(HDRP(NEXT_BLKP(run)), PACK(size - asize, PREV_ALLOC | CUR_ALLOC));
+    }
+    else
+        PUT(head, 0);
+    return run;
+}
+
+
+/*
+ * adjust_size - Turn a payload request into a block size: room for the
+ *     header, rounded up to the alignment, and never below MIN_BLOCK.
+ */
+static size_t adjust_size(size_t size)
+{
+    /* 已分配块只需头部，加固模式下再加金丝雀字 */
+    if (size <= MIN_BLOCK - OVERHEAD)
+        return MIN_BLOCK;
+    return ALIGN(size + OVERHEAD);
+}
+
+
+#if MM_SLAB
+
+/*
+ * run_push - Link run at the front of the run list whose head is at head.
+ */
+static void run_push(char *head, char *run)
+{
+    char *next = TO_PTR(GET(head));
+
+    PUT(RUN_NEXT(run), TO_OFF(next));
+    PUT(RUN_PREV(run), 0);
+    if (next != NULL)
+        PUT(RUN_PREV(next), TO_OFF(run));
+    PUT(head, TO_OFF(run));
+}
+
 
+/*
+ * run_remove - Unlink run from the run list whose head is at head.
+ */
+static void run_remove(char *head, char *run)
+{
+    char *prev = TO_PTR(GET(RUN_PREV(run)));
+    char *next = TO_PTR(GET(RUN_NEXT(run)));
+
+    if (prev != NULL)
+        PUT(RUN_NEXT(prev), TO_OFF(next));
+    else
+        PUT(head, TO_OFF(next));
+    if (next != NULL)
+        PUT(RUN_PREV(next), TO_OFF(prev));
+}
+
+
+/*
+ * run_create - Set up an all-free run for slab class c, reusing an empty
+ *     run of the current arena before growing its slab region, and put
+ *     it on the class list. Returns NULL if the slab region is full.
+ */
+static char *run_create(int c)
+{
+    char *run = TO_PTR(GET(SLAB_EMPTY));
+    int n = RUN_SLOTS(c);
+    int i;
+
+    if (run != NULL)
+        run_remove(SLAB_EMPTY, run);
     else {
-        PUT(HDRP(bp), PACK(size, 1));
-        PUT(FTRP(bp), PACK(size, 1));
+        if ((run = SLAB_SBRK(RUN_SIZE)) == (void *)-1)
+            return NULL;
+        PUT(SLAB_RUNS(arena), GET(SLAB_RUNS(arena)) + 1);
+    }
+
+    PUT(RUN_CLASS(run), c);
+    PUT(RUN_NFREE(run), n);
+    /* 位图的前 n 位置 1，其余位对应的槽不存在 */
+    for (i = 0; i < RUN_MAP_WORDS; i++, n -= 32)
+        PUT(RUN_MAP(run, i), n >= 32 ? ~0u : n > 0 ? (1u << n) - 1 : 0);
+    run_push(SLAB_HEAD(c), run);
+    return run;
+}
+
+
+/*
+ * slab_alloc - Take a free slot for a request of 1..SLAB_MAX bytes from
+ *     the first run of its class. Returns NULL if no run can be made.
+ */
+static void *slab_alloc(size_t size)
+{
+    int c = (size - 1) / ALIGNMENT;
+    char *run = TO_PTR(GET(SLAB_HEAD(c)));
+    unsigned int map;
+    int i;
+
+    if (run == NULL && (run = run_create(c)) == NULL)
+        return NULL;
+
+    /* 链表上的运行块至少有一个空闲槽 */
+    for (i = 0; (map = GET(RUN_MAP(run, i))) == 0; i++)
+        ;
+    PUT(RUN_MAP(run, i), map & (map - 1));
+    PUT(RUN_NFREE(run), GET(RUN_NFREE(run)) - 1);
+    if (GET(RUN_NFREE(run)) == 0)
+        run_remove(SLAB_HEAD(c), run);
+    PUT(SLAB_ALLOCS(arena), GET(SLAB_ALLOCS(arena)) + 1);
+    return run + RUN_HDR + (i * 32 + __builtin_ctz(map)) * SLOT_SIZE(c);
+}
+
+
+/*
+ * slab_free - Return slot bp to its run. A full run goes back on its
+ *     class list; a run that becomes empty moves to the empty list unless
+ *     it is the only run of its class.
+ */
+static void slab_free(void *bp)
+{
+    char *run = RUN_OF(bp);
+    int c = GET(RUN_CLASS(run));
+    unsigned int k = ((char *)bp - run - RUN_HDR) / SLOT_SIZE(c);
+    unsigned int nfree = GET(RUN_NFREE(run)) + 1;
+
+    PUT(RUN_MAP(run, k / 32), GET(RUN_MAP(run, k / 32)) | 1u << (k % 32));
+    PUT(RUN_NFREE(run), nfree);
+    if (nfree == 1)
+        run_push(SLAB_HEAD(c), run);
+    else if (nfree == RUN_SLOTS(c) &&
+             (GET(RUN_NEXT(run)) != 0 || GET(RUN_PREV(run)) != 0)) {
+        run_remove(SLAB_HEAD(c), run);
+        run_push(SLAB_EMPTY, run);
     }
-    pre_listp = bp;
 }
 
+#endif /* MM_SLAB */
+
 
 /*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+ * arena_malloc - Allocate a block from the current arena's free lists,
+ *     growing the arena when no free block fits. The smallest requests
+ *     get a slot instead, as long as the slab region has room.
  *     Always allocate a block whose size is a multiple of the alignment.
  */
-void *mm_malloc(size_t size)
+static void *arena_malloc(size_t size)
 {
     size_t asize; /* 调整后的块大小 */
     size_t extendsize; /* 如果没有合适的块则扩展堆的数量 */
@@ -182,11 +1128,34 @@ void *mm_malloc(size_t size)
     if (size == 0)
         return NULL;
 
+#if MM_SLAB
+    if (size <= SLAB_MAX && (bp = slab_alloc(size)) != NULL)
+        return bp;
+#endif
+
     /* 调整块大小 */
-    if (size <= DSIZE)
-        asize = 2*DSIZE;
-    else
-        asize = DSIZE * ((size + (DSIZE) + (DSIZE-1)) / DSIZE);
+    asize = adjust_size(size);
+
+    /* 快速桶中有同样大小的块就直接取用 */
+    if (asize <= QUICK_MAX && (bp = TO_PTR(GET(QUICK_HEAD(asize)))) != NULL) {
+        PUT(QUICK_HEAD(asize), GET(bp));
+        PUT(QUICK_BYTES(arena), GET(QUICK_BYTES(arena)) - asize);
+        PUT(QUICK_HITS(arena), GET(QUICK_HITS(arena)) + 1);
+        return bp;
+    }
+
+    /* 碰撞分配时只在本类中找空闲块，找不到就从本类的运行块切出 */
+    if (place_policy == MM_PLACE_BUMP && asize < TREE_MIN) {
+        for (bp = TO_PTR(GET(SEG_HEAD(seg_index(asize)))); bp != NULL;
+             bp = SUCC(bp)) {
+            if (GET_SIZE(HDRP(bp)) >= asize) {
+                place(bp, asize);
+                return bp;
+            }
+        }
+        if ((bp = bump_alloc(asize)) != NULL)
+            return bp;
+    }
 
     /* 在空闲列表中搜索合适的块 */
     if ((bp = find_fit(asize)) != NULL) {
@@ -194,6 +1163,15 @@ void *mm_malloc(size_t size)
         return bp;
     }
 
+    /* 合并快速桶中的块之后再找一次 */
+    if (GET(QUICK_BYTES(arena)) > 0) {
+        quick_sweep();
+        if ((bp = find_fit(asize)) != NULL) {
+            place(bp, asize);
+            return bp;
+        }
+    }
+
     /* 未找到合适的块，获取更多内存并放置块 */
     extendsize = MAX(asize,CHUNKSIZE);
     if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
@@ -202,78 +1180,1060 @@ void *mm_malloc(size_t size)
     return bp;
 }
 
+
+/*
+ * coalesce - Merge free block bp with its free neighbors and put the
+ *     result on the free lists. bp itself must not be on a list yet.
+ */
 static void *coalesce(void *bp)
 {
-    size_t prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
     size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
     size_t size = GET_SIZE(HDRP(bp));
-    //int isPre = (pre_listp == bp);
+
     if (prev_alloc && next_alloc) {
-        pre_listp = bp;
+        insert_free(bp);
         return bp;
     }
 
     if (prev_alloc && !next_alloc) {
+        remove_free(NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-        PUT(HDRP(bp), PACK(size, 0));
-        PUT(FTRP(bp), PACK(size,0));
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
     }
 
     else if (!prev_alloc && next_alloc) {
+        remove_free(PREV_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-        PUT(FTRP(bp), PACK(size, 0));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
         bp = PREV_BLKP(bp);
 
     }
 
     else {
+        remove_free(PREV_BLKP(bp));
+        remove_free(NEXT_BLKP(bp));
         size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
         GET_SIZE(FTRP(NEXT_BLKP(bp)));
-        PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, PREV_ALLOC));
         bp = PREV_BLKP(bp);
     }
-    pre_listp = bp;
+    insert_free(bp);
     return bp;
 }
 
 
 /*
- * mm_free - Freeing a block does nothing.
+ * arena_free - Free a block of the current arena, which must own it.
+ *     Slots go back to their run. Other blocks wait in the quarantine,
+ *     if there is one, until enough bytes were freed after them.
  */
-void mm_free(void *bp)
+static void arena_free(void *bp)
 {
-    size_t size = GET_SIZE(HDRP(bp));
+#if MM_QUARANTINE
+    char *tail;
+#endif
 
-    PUT(HDRP(bp), PACK(size, 0));
-    PUT(FTRP(bp), PACK(size, 0));
-    coalesce(bp);
+#if MM_SLAB
+    if (IS_SLAB(bp)) {
+        slab_free(bp);
+        return;
+    }
+#endif
+#if MM_QUARANTINE
+    /* 块仍标记为已分配，载荷的第一个字用作队列链接 */
+    PUT(bp, 0);
+    if ((tail = TO_PTR(GET(QUAR_TAIL))) != NULL)
+        PUT(tail, TO_OFF(bp));
+    else
+        PUT(QUAR_HEAD, TO_OFF(bp));
+    PUT(QUAR_TAIL, TO_OFF(bp));
+    PUT(QUAR_BYTES, GET(QUAR_BYTES) + GET_SIZE(HDRP(bp)));
+
+    /* 队列超出容量时从队头（最早释放的块）开始真正释放 */
+    while (GET(QUAR_BYTES) > MM_QUARANTINE) {
+        bp = TO_PTR(GET(QUAR_HEAD));
+        PUT(QUAR_HEAD, GET(bp));
+        if (GET(QUAR_HEAD) == 0)
+            PUT(QUAR_TAIL, 0);
+        PUT(QUAR_BYTES, GET(QUAR_BYTES) - GET_SIZE(HDRP(bp)));
+        heap_free(bp);
+    }
+#else
+    heap_free(bp);
+#endif
 }
 
 
 /*
- * mm_realloc - Implemented simply in terms of mm_malloc and mm_free
+ * heap_free - Free a block with a header. With deferred coalescing,
+ *     small blocks go to a quick bin, and the bins are swept once they
+ *     hold too much.
  */
-void *mm_realloc(void *ptr, size_t size)
+static void heap_free(void *bp)
 {
-    if (ptr == NULL)
-       return mm_malloc(size);
-    if (size == 0)
-       mm_free(ptr);
+    size_t size = GET_SIZE(HDRP(bp));
 
-    void *newptr;
-    size_t copySize;
-    newptr = mm_malloc(size);
-    if (newptr == NULL)
-      return NULL;
-    size = GET_SIZE(HDRP(ptr));
-    copySize = GET_SIZE(HDRP(newptr));
-    if (size < copySize)
-      copySize = size;
-    memcpy(newptr, ptr, copySize - WSIZE);
-    mm_free(ptr);
-    return newptr;
+    if (defer_limit > 0 && size <= QUICK_MAX) {
+        /* 块仍标记为已分配，载荷的第一个字用作桶链接 */
+        PUT(bp, GET(QUICK_HEAD(size)));
+        PUT(QUICK_HEAD(size), TO_OFF(bp));
+        PUT(QUICK_BYTES(arena), GET(QUICK_BYTES(arena)) + size);
+        if (GET(QUICK_BYTES(arena)) > (unsigned int)defer_limit)
+            quick_sweep();
+        return;
+    }
+    free_block(bp);
+}
+
+
+/*
+ * free_block - Mark the block free and coalesce it into the free lists
+ *     of the current arena right away.
+ */
+static void free_block(void *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+    PUT(HDRP(bp), PACK(size, prev_alloc));
+    PUT(FTRP(bp), PACK(size, prev_alloc));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+    last_freed = coalesce(bp);
+#if MM_TRIM
+    release_free(last_freed, bp, size);
+#endif
+}
+
+
+/*
+ * quick_sweep - Empty every quick bin of the current arena, freeing and
+ *     coalescing the blocks in one pass.
+ */
+static void quick_sweep(void)
+{
+    size_t size;
+    char *bp;
+
+    for (size = MIN_BLOCK; size <= QUICK_MAX; size += ALIGNMENT) {
+        while ((bp = TO_PTR(GET(QUICK_HEAD(size)))) != NULL) {
+            PUT(QUICK_HEAD(size), GET(bp));
+            free_block(bp);
+        }
+    }
+    PUT(QUICK_BYTES(arena), 0);
+    PUT(QUICK_SWEEPS(arena), GET(QUICK_SWEEPS(arena)) + 1);
+}
+
+
+/*
+ * shrink_block - Cut allocated block bp down to asize bytes and free the
+ *     tail if it is big enough to be a block of its own.
+ */
+static void shrink_block(void *bp, size_t asize)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *rest;
+
+    if (size - asize < MIN_BLOCK)
+        return;
+
+    PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | CUR_ALLOC));
+    rest = NEXT_BLKP(bp);
+    PUT(HDRP(rest), PACK(size - asize, PREV_ALLOC));
+    PUT(FTRP(rest), PACK(size - asize, PREV_ALLOC));
+    CLR_PREV_ALLOC(HDRP(NEXT_BLKP(rest)));
+#if MM_TRIM
+    release_free(coalesce(rest), rest, size - asize);
+#else
+    coalesce(rest);
+#endif
+}
+
+
+#if MM_TRIM
+/*
+ * release_free - Return memory after the block freed, of size bytes,
+ *     was merged into free block bp: shrink the arena if bp is a large
+ *     last block, otherwise discard the pages inside a large freed once
+ *     the arena already keeps RELEASE_PAD bytes of them for reuse.
+ *     Links and footers stay intact either way.
+ */
+static void release_free(char *bp, char *freed, size_t size)
+{
+    size_t prev_alloc;
+
+    if (GET_SIZE(HDRP(bp)) < TOP_PAD + TRIM_MIN ||
+        GET_SIZE(HDRP(NEXT_BLKP(bp))) != 0) {
+        if (GET_SIZE(HDRP(bp)) < RELEASE_MIN || size < 2 * mem_pagesize())
+            return;
+        /* 先留着，等下一个大块重用，留满了才丢弃 */
+        if (GET(KEEP_BYTES) + size <= RELEASE_PAD)
+            PUT(KEEP_BYTES, GET(KEEP_BYTES) + size);
+        else
+            mem_discard(freed + DSIZE, size - 2 * DSIZE);
+        return;
+    }
+
+    size = GET_SIZE(HDRP(bp));
+
+    /* 收缩堆，留下 TOP_PAD 字节的空闲块，并重写结尾块 */
+    remove_free(bp);
+    if (ARENA_SBRK(-(int)(size - TOP_PAD)) == (void *)-1) {
+        insert_free(bp);
+        return;
+    }
+    prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    PUT(HDRP(bp), PACK(TOP_PAD, prev_alloc));
+    PUT(FTRP(bp), PACK(TOP_PAD, prev_alloc));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, CUR_ALLOC));
+    insert_free(bp);
+}
+#endif
+
+
+/*
+ * arena_realloc - Resize a block of the current arena in place whenever
+ *     its neighbors allow it: shrink by splitting, grow into a free
+ *     successor, extend the heap when the block is the last one, or
+ *     slide down into a free predecessor. Only when none of these work
+ *     is the payload copied to a freshly allocated block.
+ */
+static void *arena_realloc(void *ptr, size_t size)
+{
+    size_t asize, oldsize, nextsize, prevsize, extendsize;
+    char *next, *prev, *newptr;
+    int at_tail;
+
+#if MM_SLAB
+    /* 槽不能原地增长，装得下就留在原处，否则换到新块 */
+    if (IS_SLAB(ptr)) {
+        oldsize = SLOT_SIZE(GET(RUN_CLASS(RUN_OF(ptr))));
+        if (size <= oldsize)
+            return ptr;
+        if ((newptr = arena_malloc(size)) == NULL)
+            return NULL;
+        memcpy(newptr, ptr, oldsize);
+        slab_free(ptr);
+        return newptr;
+    }
+#endif
+
+    asize = adjust_size(size);
+    oldsize = GET_SIZE(HDRP(ptr));
+
+    /* 缩小：原地分割 */
+    if (asize <= oldsize) {
+        shrink_block(ptr, asize);
+        return ptr;
+    }
+
+    next = NEXT_BLKP(ptr);
+    nextsize = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+
+    /* 块位于堆尾（或其后只有一个空闲块）：扩展堆补足差额 */
+    at_tail = GET_SIZE(HDRP(next)) == 0 ||
+        (nextsize > 0 && GET_SIZE(HDRP(NEXT_BLKP(next))) == 0);
+    if (at_tail) {
+        if (oldsize + nextsize < asize) {
+            extendsize = MAX(asize - oldsize - nextsize, MIN_BLOCK);
+            if (extend_heap(extendsize / WSIZE) == NULL)
+                return NULL;
+            nextsize = GET_SIZE(HDRP(next));
+        }
+    }
+
+    /*
+     * 后继空闲块足够大：吸收后继。位于堆尾时整块保留，
+     * 以免其他请求落在它后面，使下次增长无法原地进行
+     */
+    if (nextsize > 0 && oldsize + nextsize >= asize) {
+        remove_free(next);
+        PUT(HDRP(ptr), PACK(oldsize + nextsize,
+                            GET_PREV_ALLOC(HDRP(ptr)) | CUR_ALLOC));
+        SET_PREV_ALLOC(HDRP(NEXT_BLKP(ptr)));
+        if (!at_tail)
+            shrink_block(ptr, asize);
+        return ptr;
+    }
+
+    /* 前驱空闲块（加上后继）足够大：把数据向前移动 */
+    if (!GET_PREV_ALLOC(HDRP(ptr))) {
+        prev = PREV_BLKP(ptr);
+        prevsize = GET_SIZE(HDRP(prev));
+        if (prevsize + oldsize + nextsize >= asize) {
+            remove_free(prev);
+            if (nextsize > 0)
+                remove_free(next);
+            PUT(HDRP(prev), PACK(prevsize + oldsize + nextsize,
+                                 PREV_ALLOC | CUR_ALLOC));
+            SET_PREV_ALLOC(HDRP(NEXT_BLKP(prev)));
+            memmove(prev, ptr, oldsize - WSIZE);
+            shrink_block(prev, asize);
+            return prev;
+        }
+    }
+
+    /* 无法原地调整，只能复制 */
+    if ((newptr = arena_malloc(size)) == NULL)
+      return NULL;
+    memcpy(newptr, ptr, oldsize - WSIZE);
+    arena_free(ptr);
+    return newptr;
+}
+
+
+#if MM_MMAP_MIN
+
+/*
+ * map_len - Return the length of the mapping for a payload of size bytes.
+ */
+static size_t map_len(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    return (size + ALIGNMENT + page - 1) & ~(page - 1);
+}
+
+
+/*
+ * map_block - Give a huge request a mapping of its own. The payload
+ *     starts ALIGNMENT bytes in, behind a header tagged MAPPED.
+ */
+static void *map_block(size_t size)
+{
+    size_t len = map_len(size);
+    char *p;
+
+    /* 头部只有 32 位 */
+    if ((unsigned int)len != len || (p = mem_map(len)) == (void *)-1)
+        return NULL;
+    PUT(p + ALIGNMENT - WSIZE, PACK(len, MAPPED | CUR_ALLOC));
+    return p + ALIGNMENT;
+}
+
+
+/*
+ * unmap_block - Return the mapping of huge block bp.
+ */
+static void unmap_block(void *bp)
+{
+    mem_unmap((char *)bp - ALIGNMENT);
+}
+
+
+/*
+ * map_realloc - Resize huge block ptr. It stays mapped, and its mapping
+ *     is resized, as long as size is still huge; otherwise the payload
+ *     moves into the heap.
+ */
+static void *map_realloc(void *ptr, size_t size)
+{
+    size_t len = map_len(size);
+    size_t oldlen = GET_SIZE(HDRP(ptr));
+    char *p, *newptr;
+
+    if (size >= MM_MMAP_MIN) {
+        if (len == oldlen)
+            return ptr;
+        if ((unsigned int)len != len ||
+            (p = mem_remap((char *)ptr - ALIGNMENT, len)) == (void *)-1)
+            return NULL;
+        PUT(p + ALIGNMENT - WSIZE, PACK(len, MAPPED | CUR_ALLOC));
+        return p + ALIGNMENT;
+    }
+
+    if ((newptr = mm_malloc(size)) == NULL)
+        return NULL;
+    memcpy(newptr, ptr, size);
+    unmap_block(ptr);
+    return newptr;
+}
+
+#endif /* MM_MMAP_MIN */
+
+
+#if MM_HARDEN
+
+/*
+ * guard_of - Return the canary of a live block bp: a hash of its
+ *     address and size, keyed by guard_key.
+ */
+static unsigned int guard_of(void *bp)
+{
+    unsigned int h = (unsigned int)((uintptr_t)bp / ALIGNMENT) * 0x9E3779B1u;
+
+    return (h ^ GET_SIZE(HDRP(bp))) * 0x85EBCA6Bu ^ guard_key;
+}
+
+
+/*
+ * guard_arm - Write the canary of bp, which is about to be handed out,
+ *     and return bp. Slots and mapped blocks carry no canary.
+ */
+static void *guard_arm(void *bp)
+{
+    if (bp != NULL && !IS_SLAB(bp) && !IS_MAPPED(bp))
+        PUT(CANARY(bp), guard_of(bp));
+    return bp;
+}
+
+
+/*
+ * guard_check - Vet a pointer passed to mm_free or mm_realloc (named by
+ *     fn) and abort if it is not a live block: not aligned, outside the
+ *     heap, already free, or with a header or canary that was written
+ *     over. A block that passes gets its canary inverted, which marks
+ *     it freed while it sits in a cache, bin or the quarantine. The
+ *     reads take no lock, like those in tcache_put.
+ */
+static void guard_check(void *bp, char *fn)
+{
+    unsigned int hdr, canary;
+    size_t size;
+#if MM_SLAB
+    char *run;
+    unsigned int k;
+    int c;
+#endif
+
+    if ((uintptr_t)bp % ALIGNMENT != 0)
+        guard_fail(fn, "misaligned pointer", bp);
+    if (mem_region_of(bp) < 0) {
+        /* 只有直接映射的块位于各区域之外 */
+        if (!mem_in_heap(HDRP(bp), bp) || !(GET(HDRP(bp)) & MAPPED))
+            guard_fail(fn, "pointer outside the heap", bp);
+        return;
+    }
+#if MM_SLAB
+    if (IS_SLAB(bp)) {
+        /* 槽没有头部，只能检查它是否是某个槽的起点，以及位图中的状态 */
+        run = RUN_OF(bp);
+        c = GET(RUN_CLASS(run));
+        k = ((char *)bp - run - RUN_HDR) / SLOT_SIZE(c);
+        if ((char *)bp < run + RUN_HDR || k >= RUN_SLOTS(c) ||
+            ((char *)bp - run - RUN_HDR) % SLOT_SIZE(c) != 0)
+            guard_fail(fn, "not the start of a slot", bp);
+        if (GET(RUN_MAP(run, k / 32)) & 1u << (k % 32))
+            guard_fail(fn, "double free", bp);
+        return;
+    }
+#endif
+
+    hdr = GET(HDRP(bp));
+    size = GET_SIZE(HDRP(bp));
+    if (!(hdr & CUR_ALLOC))
+        guard_fail(fn, "double free or invalid pointer", bp);
+    if ((hdr & MAPPED) || size < MIN_BLOCK || size % ALIGNMENT != 0 ||
+        !mem_in_heap(HDRP(bp), CANARY(bp) + WSIZE - 1))
+        guard_fail(fn, "corrupted header", bp);
+    canary = GET(CANARY(bp));
+    if (canary == ~guard_of(bp))
+        guard_fail(fn, "double free", bp);
+    if (canary != guard_of(bp))
+        guard_fail(fn, "corrupted block", bp);
+    PUT(CANARY(bp), ~canary);
+}
+
+
+/*
+ * guard_fail - Report a bad pointer passed to fn and abort.
+ */
+static void guard_fail(char *fn, char *what, void *bp)
+{
+    fprintf(stderr, "%s: %s (%p)\n", fn, what, bp);
+    abort();
+}
+
+#endif /* MM_HARDEN */
+
+
+#if MM_THREADS
+
+/*
+ * arena_of - Return the arena that owns block bp: arena k sits at the
+ *     bottom of heap region k and carves its slots from region
+ *     MM_ARENAS + k.
+ */
+static char *arena_of(void *bp)
+{
+    return mem_region_lo(mem_region_of(bp) % MM_ARENAS);
+}
+
+
+/*
+ * thread_arena - Return the calling thread's home arena, binding the
+ *     thread to the next arena round-robin on its first call.
+ */
+static char *thread_arena(void)
+{
+    int i;
+
+    if (home_arena == NULL) {
+        i = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+        home_arena = mem_region_lo(i % MM_ARENAS);
+    }
+    return home_arena;
+}
+
+
+/*
+ * lock_arena - Lock arena a, make it the current arena and free the
+ *     blocks other threads have queued on its remote-free stack.
+ */
+static void lock_arena(char *a)
+{
+    unsigned int off;
+    char *bp;
+
+    pthread_mutex_lock(ARENA_LOCK(a));
+    arena = a;
+
+    /* 一次取走整个栈，之后的压栈不会受影响 */
+    if (__atomic_load_n(ARENA_REMOTE(a), __ATOMIC_RELAXED) == 0)
+        return;
+    off = __atomic_exchange_n(ARENA_REMOTE(a), 0, __ATOMIC_ACQUIRE);
+    while ((bp = TO_PTR(off)) != NULL) {
+        off = GET(bp);
+        arena_free(bp);
+    }
+}
+
+
+/*
+ * unlock_arena - Release the lock taken by lock_arena.
+ */
+static void unlock_arena(char *a)
+{
+    pthread_mutex_unlock(ARENA_LOCK(a));
+}
+
+
+/*
+ * remote_free - Push block bp onto the remote-free stack of arena a,
+ *     which owns it, without taking a's lock.
+ */
+static void remote_free(char *a, void *bp)
+{
+    unsigned int old;
+
+    /* 块仍标记为已分配，载荷的第一个字用作栈链接 */
+    old = __atomic_load_n(ARENA_REMOTE(a), __ATOMIC_RELAXED);
+    do {
+        PUT(bp, old);
+    } while (!__atomic_compare_exchange_n(ARENA_REMOTE(a), &old, TO_OFF(bp),
+                                          1, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+
+#if MM_TCACHE
+/*
+ * release_block - Free bp while holding the lock of the current arena:
+ *     directly if the current arena owns it, through the owner's
+ *     remote-free stack otherwise.
+ */
+static void release_block(void *bp)
+{
+    char *a = arena_of(bp);
+
+    if (a == arena)
+        arena_free(bp);
+    else
+        remote_free(a, bp);
+}
+#endif
+
+#endif /* MM_THREADS */
+
+
+#if MM_TCACHE
+
+/*
+ * tcache_create - Allocate the calling thread's cache control block
+ *     from its home arena and empty all of its bins.
+ */
+static char *tcache_create(void)
+{
+    int i;
+
+#if MM_THREADS
+    char *a = thread_arena();
+
+    lock_arena(a);
+    tcache = arena_malloc(TC_SIZE);
+    unlock_arena(a);
+#else
+    tcache = arena_malloc(TC_SIZE);
+#endif
+    if (tcache == NULL)
+        return NULL;
+    for (i = 0; i < 2 * TC_BINS; i++)
+        PUT(tcache + i * WSIZE, 0);
+#if MM_THREADS
+    pthread_setspecific(tc_key, tcache);
+#endif
+    return tcache;
+}
+
+
+/*
+ * tcache_get - Pop a cached block for a request of size bytes, or
+ *     return NULL if the request is not small or its bin is empty.
+ */
+static void *tcache_get(size_t size)
+{
+    size_t asize;
+    char *bp;
+
+    if (size == 0 || size > TCACHE_MAX - OVERHEAD)
+        return NULL;
+#if MM_SLAB
+    if (size <= SLAB_MAX)
+        return NULL;
+#endif
+
+    asize = adjust_size(size);
+    if (tcache == NULL || (bp = TO_PTR(GET(TC_BIN(asize)))) == NULL) {
+        tc_misses++;
+        return NULL;
+    }
+    PUT(TC_BIN(asize), GET(bp));
+    PUT(TC_COUNT(asize), GET(TC_COUNT(asize)) - 1);
+    tc_hits++;
+    return bp;
+}
+
+
+/*
+ * tcache_flush - Hand up to n blocks of the bin for size back to the
+ *     heap, taking the arena lock once for the whole batch.
+ */
+static void tcache_flush(size_t size, int n)
+{
+    char *bp;
+
+#if MM_THREADS
+    char *a = thread_arena();
+
+    lock_arena(a);
+#endif
+    for (; n > 0 && (bp = TO_PTR(GET(TC_BIN(size)))) != NULL; n--) {
+        PUT(TC_BIN(size), GET(bp));
+        PUT(TC_COUNT(size), GET(TC_COUNT(size)) - 1);
+        tc_flushes++;
+#if MM_THREADS
+        release_block(bp);
+#else
+        arena_free(bp);
+#endif
+    }
+#if MM_THREADS
+    unlock_arena(a);
+#endif
+}
+
+
+/*
+ * tcache_put - Cache a small block instead of freeing it. The block
+ *     stays marked allocated, so nothing is coalesced. A full bin is
+ *     first flushed halfway. Returns 0 if bp is a slot or a block of the
+ *     wrong size to cache.
+ */
+static int tcache_put(void *bp)
+{
+    size_t size;
+
+    /* 槽没有头部，直接交还运行块 */
+    if (IS_SLAB(bp))
+        return 0;
+
+    /*
+     * 不加锁读取头部：属主分配区此时只可能修改其中的前块已分配位，
+     * 而这里只用到大小字段
+     */
+    size = GET_SIZE(HDRP(bp));
+    if (size < TCACHE_MIN || size > TCACHE_MAX)
+        return 0;
+    if (tcache == NULL && tcache_create() == NULL)
+        return 0;
+
+    if (GET(TC_COUNT(size)) >= TCACHE_COUNT)
+        tcache_flush(size, TCACHE_COUNT / 2 + 1);
+    PUT(bp, GET(TC_BIN(size)));
+    PUT(TC_BIN(size), TO_OFF(bp));
+    PUT(TC_COUNT(size), GET(TC_COUNT(size)) + 1);
+    return 1;
+}
+
+#if MM_THREADS
+/*
+ * tcache_destroy - Thread-exit destructor: flush every bin, free the
+ *     control block and fold the thread's counters into the totals.
+ */
+static void tcache_destroy(void *tc)
+{
+    size_t size;
+    char *a;
+
+    tcache = tc;
+    for (size = MIN_BLOCK; size <= TCACHE_MAX; size += ALIGNMENT)
+        tcache_flush(size, TCACHE_COUNT);
+
+    a = thread_arena();
+    lock_arena(a);
+    release_block(tcache);
+    unlock_arena(a);
+    tcache = NULL;
+
+    __atomic_add_fetch(&tc_done_hits, tc_hits, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tc_done_misses, tc_misses, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tc_done_flushes, tc_flushes, __ATOMIC_RELAXED);
+    tc_hits = tc_misses = tc_flushes = 0;
+}
+#endif
+
+#endif /* MM_TCACHE */
+
+
+#if MM_THREADS
+
+/*
+ * mm_malloc - Map huge requests and serve small ones from the thread
+ *     cache, both without any locking; everything else comes from the
+ *     calling thread's home arena.
+ */
+void *mm_malloc(size_t size)
+{
+    char *a;
+    void *bp;
+
+#if MM_MMAP_MIN
+    if (size >= MM_MMAP_MIN)
+        return map_block(size);
+#endif
+#if MM_TCACHE
+    if ((bp = tcache_get(size)) != NULL)
+        return GUARD_ARM(bp);
+#endif
+    a = thread_arena();
+    lock_arena(a);
+    bp = arena_malloc(size);
+    unlock_arena(a);
+    return GUARD_ARM(bp);
+}
+
+
+/*
+ * mm_free - Unmap huge blocks and cache small blocks in the thread
+ *     cache. Otherwise free a
+ *     block of the home arena directly, and push a block owned by
+ *     another arena onto that arena's remote-free stack instead of
+ *     taking its lock.
+ */
+void mm_free(void *bp)
+{
+    char *a;
+
+    if (bp == NULL)
+        return;
+#if MM_HARDEN
+    guard_check(bp, "mm_free");
+#endif
+#if MM_MMAP_MIN
+    if (IS_MAPPED(bp)) {
+        unmap_block(bp);
+        return;
+    }
+#endif
+#if MM_TCACHE
+    if (tcache_put(bp))
+        return;
+#endif
+
+    a = arena_of(bp);
+    if (a == thread_arena()) {
+        lock_arena(a);
+        arena_free(bp);
+        unlock_arena(a);
+    }
+    else
+        remote_free(a, bp);
+}
+
+
+/*
+ * mm_realloc - Resize a huge block by resizing its mapping, any other
+ *     block under the lock of the arena that owns it.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+    char *a;
+    void *newptr;
+
+    if (ptr == NULL)
+       return mm_malloc(size);
+    if (size == 0) {
+       mm_free(ptr);
+       return NULL;
+    }
+#if MM_HARDEN
+    guard_check(ptr, "mm_realloc");
+#endif
+#if MM_MMAP_MIN
+    if (IS_MAPPED(ptr))
+        return map_realloc(ptr, size);
+#endif
+
+    a = arena_of(ptr);
+    lock_arena(a);
+    newptr = arena_realloc(ptr, size);
+    unlock_arena(a);
+#if MM_HARDEN
+    /* 失败时原块仍然有效，要恢复它的金丝雀 */
+    guard_arm(newptr != NULL ? newptr : ptr);
+#endif
+    return newptr;
+}
+
+#else
+
+/*
+ * mm_malloc - Allocate a block of at least size bytes: map huge ones,
+ *     and try the thread cache first for the rest.
+ */
+void *mm_malloc(size_t size)
+{
+#if MM_TCACHE
+    void *bp;
+#endif
+
+#if MM_MMAP_MIN
+    if (size >= MM_MMAP_MIN)
+        return map_block(size);
+#endif
+#if MM_TCACHE
+    if ((bp = tcache_get(size)) != NULL)
+        return GUARD_ARM(bp);
+#endif
+    return GUARD_ARM(arena_malloc(size));
+}
+
+
+/*
+ * mm_free - Free a block returned by mm_malloc or mm_realloc, unmapping
+ *     huge blocks and parking small ones in the thread cache.
+ */
+void mm_free(void *bp)
+{
+    if (bp == NULL)
+        return;
+#if MM_HARDEN
+    guard_check(bp, "mm_free");
+#endif
+#if MM_MMAP_MIN
+    if (IS_MAPPED(bp)) {
+        unmap_block(bp);
+        return;
+    }
+#endif
+#if MM_TCACHE
+    if (tcache_put(bp))
+        return;
+#endif
+    arena_free(bp);
+}
+
+
+/*
+ * mm_realloc - Resize a block, keeping its contents.
+ */
+void *mm_realloc(void *ptr, size_t size)
+{
+#if MM_HARDEN
+    void *newptr;
+#endif
+
+    if (ptr == NULL)
+       return mm_malloc(size);
+    if (size == 0) {
+       mm_free(ptr);
+       return NULL;
+    }
+#if MM_HARDEN
+    guard_check(ptr, "mm_realloc");
+#endif
+#if MM_MMAP_MIN
+    if (IS_MAPPED(ptr))
+        return map_realloc(ptr, size);
+#endif
+#if MM_HARDEN
+    /* 失败时原块仍然有效，要恢复它的金丝雀 */
+    newptr = arena_realloc(ptr, size);
+    guard_arm(newptr != NULL ? newptr : ptr);
+    return newptr;
+#else
+    return arena_realloc(ptr, size);
+#endif
+}
+
+#endif /* MM_THREADS */
+
+
+/*
+ * mm_info - Report allocator statistics gathered since mm_init. Thread
+ *     cache counters cover exited threads plus the calling thread; slab
+ *     and quick bin counters cover all arenas.
+ */
+void mm_info(mm_info_t *info)
+{
+    int i;
+    char *a;
+
+    memset(info, 0, sizeof(*info));
+    for (i = 0; i < NUM_ARENAS; i++) {
+        a = mem_region_lo(i);
+#if MM_THREADS
+        pthread_mutex_lock(ARENA_LOCK(a));
+#endif
+#if MM_SLAB
+        info->slab_runs += GET(SLAB_RUNS(a));
+        info->slab_allocs += GET(SLAB_ALLOCS(a));
+#endif
+        info->quick_hits += GET(QUICK_HITS(a));
+        info->quick_sweeps += GET(QUICK_SWEEPS(a));
+#if MM_THREADS
+        pthread_mutex_unlock(ARENA_LOCK(a));
+#endif
+    }
+#if MM_TCACHE
+    info->tcache_hits = tc_hits;
+    info->tcache_misses = tc_misses;
+    info->tcache_flushes = tc_flushes;
+#if MM_THREADS
+    info->tcache_hits += __atomic_load_n(&tc_done_hits, __ATOMIC_RELAXED);
+    info->tcache_misses += __atomic_load_n(&tc_done_misses, __ATOMIC_RELAXED);
+    info->tcache_flushes += __atomic_load_n(&tc_done_flushes, __ATOMIC_RELAXED);
+#endif
+#endif
+}
+
+
+/*
+ * mm_layout - Walk every arena and slab region and report how the heap
+ *     is used right now. Parked blocks are those in quick bins, in the
+ *     quarantine and in the calling thread's cache; mapped blocks count
+ *     as allocated with their whole mapping. Takes each arena's lock in
+ *     turn, so the picture is exact only while no other thread runs.
+ */
+void mm_layout(mm_layout_t *layout)
+{
+    char *saved = arena;
+    char *bp, *end;
+    size_t size, regions = 0;
+    int i, bin;
+#if MM_SLAB
+    char *run;
+    int c;
+#endif
+
+    memset(layout, 0, sizeof(*layout));
+    for (i = 0; i < NUM_ARENAS; i++) {
+        arena = mem_region_lo(i);
+#if MM_THREADS
+        pthread_mutex_lock(ARENA_LOCK(arena));
+#endif
+        end = mem_region_sbrk(i, 0);
+        regions += end - arena;
+        bp = NEXT_BLKP(arena + ARENA_SIZE + 2 * WSIZE); /* after the prologue */
+        for (; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+            size = GET_SIZE(HDRP(bp));
+            if (GET_ALLOC(HDRP(bp))) {
+                layout->alloc_bytes += size;
+                continue;
+            }
+            layout->free_bytes += size;
+            layout->free_blocks++;
+            layout->largest_free = MAX(layout->largest_free, size);
+            for (bin = 0; bin < MM_LAYOUT_BINS - 1 &&
+                     size >= (size_t)MIN_BLOCK << (bin + 1); bin++)
+                ;
+            layout->free_hist[bin]++;
+        }
+        layout->parked_bytes += GET(QUICK_BYTES(arena));
+        for (bin = 0; bin < SEG_LISTS; bin++) {
+            if ((bp = TO_PTR(GET(BUMP_HEAD(bin)))) != NULL)
+                layout->parked_bytes += GET_SIZE(HDRP(bp));
+        }
+#if MM_QUARANTINE
+        layout->parked_bytes += GET(QUAR_BYTES);
+#endif
+
+#if MM_SLAB
+        /* 槽按所在运行块的空闲计数划分 */
+        end = mem_region_sbrk(NUM_ARENAS + i, 0);
+        regions += end - (char *)mem_region_lo(NUM_ARENAS + i);
+        for (run = mem_region_lo(NUM_ARENAS + i); run < end; run += RUN_SIZE) {
+            c = GET(RUN_CLASS(run));
+            layout->alloc_bytes += (RUN_SLOTS(c) - GET(RUN_NFREE(run))) *
+                SLOT_SIZE(c);
+            layout->slot_free_bytes += GET(RUN_NFREE(run)) * SLOT_SIZE(c);
+        }
+#endif
+#if MM_THREADS
+        pthread_mutex_unlock(ARENA_LOCK(arena));
+#endif
+    }
+    arena = saved;
+
+#if MM_TCACHE
+    if (tcache != NULL) {
+        for (size = MIN_BLOCK; size <= TCACHE_MAX; size += ALIGNMENT)
+            layout->parked_bytes += GET(TC_COUNT(size)) * size;
+    }
+#endif
+
+    /* 区域之外的堆空间都是直接映射的大块 */
+    layout->heap_bytes = mem_heapsize();
+    layout->alloc_bytes += layout->heap_bytes - regions;
+    layout->other_bytes = layout->heap_bytes - layout->alloc_bytes -
+        layout->free_bytes - layout->slot_free_bytes;
+}
+
+
+/*
+ * mm_mallopt - Set allocator parameter param to value, in the manner of
+ *     mallopt. Returns 1 on success and 0 if param or value is invalid.
+ *     Call it while no other thread is inside the allocator.
+ *
+ *     MM_OPT_DEFER: bytes of freed blocks each arena may keep in its
+ *     quick bins before sweeping them; 0, the default, coalesces every
+ *     block as it is freed. Blocks already binned stay there until the
+ *     next sweep.
+ *
+ *     MM_OPT_PLACE: placement policy for blocks under TREE_MIN, one of
+ *     the MM_PLACE_* values; used from the next mm_init on, since the
+ *     free lists of a live heap are ordered for the old one.
+ */
+int mm_mallopt(int param, int value)
+{
+    switch (param) {
+    case MM_OPT_DEFER:
+        if (value < 0)
+            return 0;
+        defer_limit = value;
+        return 1;
+    case MM_OPT_PLACE:
+        if (value < MM_PLACE_BEST || value > MM_PLACE_BUMP)
+            return 0;
+        place_option = value;
+        return 1;
+    default:
+        return 0;
+    }
 }
 
 
@@ -281,118 +2241,432 @@ void *mm_realloc(void *ptr, size_t size)
 /* below code if for check heap invarints */
 
 /*
-static void printblock(void *bp)
+ * check_error - Report problem what with block bp and return 1, so
+ *     that callers can add up the problems they find.
+ */
+static int check_error(void *bp, char *what)
 {
-    long int hsize, halloc, fsize, falloc;
+    printf("Error: %p: %s\n", bp, what);
+    return 1;
+}
 
-    hsize = GET_SIZE(HDRP(bp));
-    halloc = GET_ALLOC(HDRP(bp));
-    fsize = GET_SIZE(FTRP(bp));
-    falloc = GET_ALLOC(FTRP(bp));
+
+/*
+ * printblock - Print the header, and for a free block the footer, of bp.
+ */
+static void printblock(void *bp)
+{
+    size_t hsize = GET_SIZE(HDRP(bp));
+    int halloc = GET_ALLOC(HDRP(bp));
 
     if (hsize == 0) {
         printf("%p: EOL\n", bp);
         return;
     }
+    if (halloc)
+        printf("%p: header: [%zu:a]\n", bp, hsize);
+    else
+        printf("%p: header: [%zu:f] footer: [%zu:%c]\n", bp, hsize,
+               (size_t)GET_SIZE(FTRP(bp)), GET_ALLOC(FTRP(bp)) ? 'a' : 'f');
+}
+
 
-    printf("%p: header: [%ld:%c] footer: [%ld:%c]\n", bp,
-           hsize, (halloc ? 'a' : 'f'),
-           fsize, (falloc ? 'a' : 'f'));
+/*
+ * check_link - Return 1 if free-list link target p is a plausible block
+ *     of the same region as bp; NULL links are always fine.
+ */
+static int check_link(char *bp, char *p)
+{
+    return p == NULL || ((size_t)(p - heap_base) % ALIGNMENT == 0 &&
+                         mem_region_of(p) == mem_region_of(bp));
 }
 
-static int checkblock(void *bp)
+
+/*
+ * check_links - Check the free-structure neighbors of free block bp in
+ *     constant time: its list predecessor and successor must link back
+ *     to it in list order, or its tree children must order around it.
+ */
+static int check_links(char *bp)
 {
-    //area is aligned
-    if ((size_t)bp % 8)
-        printf("Error: %p is not doubleword aligned\n", bp);
-    //header and footer match
-    if (GET(HDRP(bp)) != GET(FTRP(bp)))
-        printf("Error: header does not match footer\n");
     size_t size = GET_SIZE(HDRP(bp));
-    //size is valid
-    if (size % 8)
-       printf("Error: %p payload size is not doubleword aligned\n", bp);
-    return GET_ALLOC(HDRP(bp));
+    char *pred, *succ;
+    int errs = 0;
+
+    if (size >= TREE_MIN) {
+        /* 树节点没有父链接，只能检查两个孩子 */
+        if (!check_link(bp, LEFT(bp)) || !check_link(bp, RIGHT(bp)))
+            return check_error(bp, "tree link leaves the region");
+        if (LEFT(bp) != NULL && tree_cmp(size, bp, LEFT(bp)) <= 0)
+            errs += check_error(bp, "left child does not sort before node");
+        if (RIGHT(bp) != NULL && tree_cmp(size, bp, RIGHT(bp)) >= 0)
+            errs += check_error(bp, "right child does not sort after node");
+        return errs;
+    }
+
+    pred = PRED(bp);
+    succ = SUCC(bp);
+    if (!check_link(bp, pred) || !check_link(bp, succ))
+        return check_error(bp, "list link leaves the region");
+    if (pred == NULL) {
+        if (TO_PTR(GET(SEG_HEAD(seg_index(size)))) != bp)
+            errs += check_error(bp, "first block of a list is not its head");
+    }
+    else if (SUCC(pred) != bp || list_before(bp, pred) ||
+             GET_SIZE(HDRP(pred)) >= TREE_MIN ||
+             seg_index(GET_SIZE(HDRP(pred))) != seg_index(size))
+        errs += check_error(bp, "bad predecessor link");
+    if (succ != NULL && (PRED(succ) != bp || list_before(succ, bp) ||
+                         GET_SIZE(HDRP(succ)) >= TREE_MIN ||
+                         seg_index(GET_SIZE(HDRP(succ))) != seg_index(size)))
+        errs += check_error(bp, "bad successor link");
+    return errs;
 }
 
-static void printlist(void *i, long size)
-{
-    long int hsize, halloc;
 
-    for(;i != NULL;i = SUCC(i))
-    {
-        hsize = GET_SIZE(HDRP(i));
-        halloc = GET_ALLOC(HDRP(i));
-        printf("[listnode %ld] %p: header: [%ld:%c] prev: [%p]  next: [%p]\n",
-           size, i,
-           hsize, (halloc ? 'a' : 'f'),
-           PRED(i), SUCC(i));
+/*
+ * check_block - Check block bp of the current arena and its boundary
+ *     tags against both neighbors, plus its links if it is free. Costs
+ *     the same for every block, so it serves both the full walk and
+ *     the per-operation check.
+ */
+static int check_block(char *bp)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    unsigned int hdr = GET(HDRP(bp));
+    char *prev, *next;
+    int errs = 0;
+
+    if ((size_t)(bp - heap_base) % ALIGNMENT != 0)
+        return check_error(bp, "payload is not aligned");
+    if (size < MIN_BLOCK || size % ALIGNMENT != 0 || (hdr & MAPPED))
+        return check_error(bp, "bad header");
+    if (!mem_in_heap(HDRP(bp), HDRP(bp) + size + WSIZE - 1))
+        return check_error(bp, "block runs past the end of its region");
+
+    /* 后一个块的前块已分配位必须与本块一致 */
+    next = NEXT_BLKP(bp);
+    if (!GET_PREV_ALLOC(HDRP(next)) != !(hdr & CUR_ALLOC))
+        errs += check_error(bp, "prev-alloc bit of next block is wrong");
+
+    /* 前一个块空闲时，它的脚部必须与头部一致并且正好通到本块 */
+    if (!GET_PREV_ALLOC(HDRP(bp))) {
+        prev = PREV_BLKP(bp);
+        if (!mem_in_heap(HDRP(prev), bp) || GET_ALLOC(HDRP(prev)) ||
+            GET(HDRP(prev)) != GET(FTRP(prev)) || NEXT_BLKP(prev) != bp)
+            errs += check_error(bp, "prev-alloc bit clear but no free block before");
     }
+
+    if (hdr & CUR_ALLOC)
+        return errs;
+    if (GET(FTRP(bp)) != hdr)
+        errs += check_error(bp, "header does not match footer");
+    if (!GET_PREV_ALLOC(HDRP(bp)) || !GET_ALLOC(HDRP(next)))
+        errs += check_error(bp, "two free blocks in a row");
+    return errs + check_links(bp);
+}
+
+
+#if MM_SLAB
+/*
+ * check_run - Check that the header of run has a valid class and that
+ *     its free count matches its bitmap.
+ */
+static int check_run(char *run)
+{
+    int c = GET(RUN_CLASS(run));
+    unsigned int n = 0;
+    int i;
+
+    if (c < 0 || c >= SLAB_CLASSES)
+        return check_error(run, "run has a bad class");
+    for (i = 0; i < RUN_MAP_WORDS; i++)
+        n += __builtin_popcount(GET(RUN_MAP(run, i)));
+    if (GET(RUN_NFREE(run)) != n || n > (unsigned int)RUN_SLOTS(c))
+        return check_error(run, "run free count does not match its bitmap");
+    return 0;
+}
+
+
+/*
+ * check_slot - Check that bp is the start of an allocated slot.
+ */
+static int check_slot(char *bp)
+{
+    char *run = RUN_OF(bp);
+    unsigned int k;
+    int c;
+
+    if (check_run(run))
+        return 1;
+    c = GET(RUN_CLASS(run));
+    k = (bp - run - RUN_HDR) / SLOT_SIZE(c);
+    if (bp < run + RUN_HDR || (bp - run - RUN_HDR) % SLOT_SIZE(c) != 0 ||
+        k >= (unsigned int)RUN_SLOTS(c))
+        return check_error(bp, "not the start of a slot");
+    if (GET(RUN_MAP(run, k / 32)) & 1u << (k % 32))
+        return check_error(bp, "slot is marked free");
+    return 0;
 }
 
-static void checklist(void *i, size_t tar)
+
+/*
+ * check_slab - Check every run in the slab region of the current arena
+ *     and the run lists in its header.
+ */
+static int check_slab(int region)
 {
-    void *pre = NULL;
-    long int hsize, halloc;
-    for(;i != NULL;i = SUCC(i))
-    {
-        if (PRED(i) != pre) printf("Error: pred point error\n");
-        if (pre != NULL && SUCC(pre) != i) printf("Error: succ point error\n");
-        hsize = GET_SIZE(HDRP(i));
-        halloc = GET_ALLOC(HDRP(i));
-        if (halloc) printf("Error: list node should be free\n");
-        if (pre != NULL && (GET_SIZE(HDRP(pre)) > hsize))
-           printf("Error: list size order error\n");
-        if (hsize < tar || ((tar != (1<<15)) && (hsize > (tar << 1)-1)))
-           printf("Error: list node size error\n");
-        pre = i;
+    char *end = mem_region_sbrk(region, 0);
+    char *run;
+    long nruns = 0, limit;
+    int c, errs = 0;
+
+    for (run = mem_region_lo(region); run < end; run += RUN_SIZE) {
+        errs += check_run(run);
+        nruns++;
     }
-} */
+    if (errs > 0)
+        return errs;
+
+    /* 链表上的运行块数不能超过实际数目，否则链表有环 */
+    for (c = 0; c <= SLAB_CLASSES; c++) {
+        char *head = c < SLAB_CLASSES ? SLAB_HEAD(c) : SLAB_EMPTY;
+        char *prev = NULL;
+
+        limit = nruns;
+        for (run = TO_PTR(GET(head)); run != NULL; run = TO_PTR(GET(RUN_NEXT(run)))) {
+            if (mem_region_of(run) != region || --limit < 0)
+                return errs + check_error(run, "run list is corrupted");
+            if (TO_PTR(GET(RUN_PREV(run))) != prev)
+                errs += check_error(run, "bad run predecessor link");
+            if (c < SLAB_CLASSES && (GET(RUN_CLASS(run)) != (unsigned int)c ||
+                                     GET(RUN_NFREE(run)) == 0))
+                errs += check_error(run, "full or foreign run on a class list");
+            if (c == SLAB_CLASSES &&
+                GET(RUN_NFREE(run)) != (unsigned int)RUN_SLOTS(GET(RUN_CLASS(run))))
+                errs += check_error(run, "used run on the empty list");
+            prev = run;
+        }
+    }
+    return errs;
+}
+#endif /* MM_SLAB */
 
 
 /*
- * mm_checkheap - Check the heap for correctness
+ * check_tree - Check the subtree at t, whose keys must lie strictly
+ *     between those of nodes lo and hi (NULL for no bound), and return
+ *     the number of nodes in it.
  */
+static long check_tree(char *t, char *lo, char *hi, int *errs)
+{
+    size_t size;
+
+    if (t == NULL)
+        return 0;
+    size = GET_SIZE(HDRP(t));
+    if (GET_ALLOC(HDRP(t)) || size < TREE_MIN) {
+        *errs += check_error(t, "allocated or small block in the tree");
+        return 0;
+    }
+    if ((lo != NULL && tree_cmp(size, t, lo) <= 0) ||
+        (hi != NULL && tree_cmp(size, t, hi) >= 0)) {
+        *errs += check_error(t, "tree is out of order");
+        return 0;
+    }
+    return 1 + check_tree(LEFT(t), lo, t, errs) +
+        check_tree(RIGHT(t), t, hi, errs);
+}
+
 
 /*
-void mm_checkheap(int verbose)
+ * check_parked - Walk a list of blocks that were freed but are still
+ *     marked allocated (a quick bin, the quarantine, a thread cache bin),
+ *     linked through their first payload word, and return their total
+ *     size. Every block must be allocated, of size bytes unless size is
+ *     0, and with MM_HARDEN carry an inverted canary.
+ */
+static size_t check_parked(char *bp, size_t size, int *errs)
 {
-    checkheap(verbose);
+    size_t bytes = 0;
+    long limit = mem_heapsize() / MIN_BLOCK;
+
+    for (; bp != NULL; bp = TO_PTR(GET(bp))) {
+        if ((size_t)(bp - heap_base) % ALIGNMENT != 0 ||
+            mem_region_of(bp) < 0 || --limit < 0) {
+            *errs += check_error(bp, "list of freed blocks is corrupted");
+            break;
+        }
+        if (!GET_ALLOC(HDRP(bp)) || (size != 0 && GET_SIZE(HDRP(bp)) != size))
+            *errs += check_error(bp, "freed block has the wrong size or state");
+#if MM_HARDEN
+        else if (GET(CANARY(bp)) != ~guard_of(bp))
+            *errs += check_error(bp, "freed block was written to");
+#endif
+        bytes += GET_SIZE(HDRP(bp));
+    }
+    return bytes;
 }
 
-void checkheap(int verbose)
+
+/*
+ * check_arena - Walk every block of the arena in heap region i, then its
+ *     free lists, tree, quick bins, quarantine and slab runs, and make
+ *     sure they all agree. Returns the number of problems found.
+ */
+static int check_arena(int i, int verbose)
 {
-    char *bp = heap_listp;
+    char *bp, *prev;
+    long nfree = 0, nlisted = 0;
+    size_t size;
+    int c, errs = 0;
 
+    arena = mem_region_lo(i);
+    bp = arena + ARENA_SIZE + 2 * WSIZE;
     if (verbose)
-        printf("Heap (%p):\n", heap_listp);
-
-    if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp)))
-        printf("Bad prologue header\n");
-    // block level
-    checkblock(heap_listp);
-    int pre_free = 0;
-    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+        printf("Arena %d (%p):\n", i, arena);
+    if (GET(HDRP(bp)) != PACK(DSIZE, PREV_ALLOC | CUR_ALLOC))
+        errs += check_error(bp, "bad prologue header");
+
+    /* 块一级：头部损坏时无法继续遍历 */
+    for (bp = NEXT_BLKP(bp); GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
         if (verbose)
             printblock(bp);
-        int cur_free = checkblock(bp);
-        //no contiguous free blocks
-        if (pre_free && cur_free) {
-            printf("Contiguous free blocks\n");
+        if ((c = check_block(bp)) > 0)
+            return errs + c;
+        if (!GET_ALLOC(HDRP(bp)))
+            nfree++;
+    }
+    if (verbose)
+        printblock(bp);
+    if (!GET_ALLOC(HDRP(bp)) || bp != (char *)mem_region_sbrk(i, 0))
+        errs += check_error(bp, "bad epilogue header");
+
+    /* 链表一级：每个链表按放置策略排序，且只含本类的空闲块 */
+    for (c = 0; c < SEG_LISTS; c++) {
+        prev = NULL;
+        for (bp = TO_PTR(GET(SEG_HEAD(c))); bp != NULL; bp = SUCC(bp)) {
+            if (!check_link(arena, bp) || ++nlisted > nfree) {
+                errs += check_error(bp, "free list is corrupted");
+                break;
+            }
+            size = GET_SIZE(HDRP(bp));
+            if (GET_ALLOC(HDRP(bp)) || size >= TREE_MIN || seg_index(size) != c)
+                errs += check_error(bp, "allocated or foreign block on a free list");
+            if (PRED(bp) != prev || (prev != NULL && list_before(bp, prev)))
+                errs += check_error(bp, "free list is out of order");
+            prev = bp;
         }
+    }
+    nlisted += check_tree(TO_PTR(GET(TREE_ROOT)), NULL, NULL, &errs);
+    if (nlisted != nfree) {
+        printf("Error: arena %d: %ld free blocks but %ld on lists and tree\n",
+               i, nfree, nlisted);
+        errs++;
+    }
 
+    /* 仍标记为已分配的已释放块 */
+    size = 0;
+    for (c = MIN_BLOCK; c <= QUICK_MAX; c += ALIGNMENT)
+        size += check_parked(TO_PTR(GET(QUICK_HEAD(c))), c, &errs);
+    if (size != GET(QUICK_BYTES(arena)))
+        errs += check_error(arena, "quick bin byte count is wrong");
+#if MM_QUARANTINE
+    if (check_parked(TO_PTR(GET(QUAR_HEAD)), 0, &errs) != GET(QUAR_BYTES))
+        errs += check_error(arena, "quarantine byte count is wrong");
+#endif
+
+    /* 碰撞分配运行块是本分配区中标记为已分配的块 */
+    for (c = 0; c < SEG_LISTS; c++) {
+        if ((bp = TO_PTR(GET(BUMP_HEAD(c)))) == NULL)
+            continue;
+        if (place_policy != MM_PLACE_BUMP || !check_link(arena, bp) ||
+            !GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) < MIN_BLOCK)
+            errs += check_error(bp, "bad bump run");
     }
-    //list level
-    int i = 0, tarsize = 1;
-    for (; i < LISTMAX; i++) {
-        if (verbose)
-            printlist(seg_free_lists[i], tarsize);
-        checklist(seg_free_lists[i],tarsize);
-        tarsize <<= 1;
+
+#if MM_SLAB
+    errs += check_slab(NUM_ARENAS + i);
+#endif
+    return errs;
+}
+
+
+/*
+ * mm_checkheap - Check the whole heap: every block and free structure
+ *     of every arena, and the calling thread's cache. Prints each
+ *     problem and returns how many there were; with verbose, also
+ *     prints every block. Takes no locks, so no other thread may be
+ *     inside the allocator.
+ */
+int mm_checkheap(int verbose)
+{
+    char *saved = arena;
+    int i, errs = 0;
+#if MM_TCACHE
+    size_t size;
+    int n;
+#endif
+
+    for (i = 0; i < NUM_ARENAS; i++)
+        errs += check_arena(i, verbose);
+    arena = saved;
+
+#if MM_TCACHE
+    if (tcache != NULL) {
+        for (size = MIN_BLOCK; size <= TCACHE_MAX; size += ALIGNMENT) {
+            n = check_parked(TO_PTR(GET(TC_BIN(size))), size, &errs) / size;
+            if (n != (int)GET(TC_COUNT(size)))
+                errs += check_error(tcache, "thread cache count is wrong");
+        }
     }
+#endif
+    return errs;
+}
 
-    if (verbose)
-        printblock(bp);
-    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
-        printf("Bad epilogue header\n");
-} */
\ No newline at end of file
+
+/*
+ * check_touched - Check block, slot or mapped block bp, whichever arena
+ *     owns it.
+ */
+static int check_touched(char *bp)
+{
+#if MM_SLAB
+    if (IS_SLAB(bp))
+        return check_slot(bp);
+#endif
+    if (mem_region_of(bp) < 0) {
+        /* 只有直接映射的块位于各区域之外 */
+        if (!mem_in_heap(HDRP(bp), bp) || !(GET(HDRP(bp)) & MAPPED) ||
+            !mem_in_heap(bp - ALIGNMENT, bp - ALIGNMENT + GET_SIZE(HDRP(bp)) - 1))
+            return check_error(bp, "bad mapped block");
+        return 0;
+    }
+#if MM_THREADS
+    arena = arena_of(bp);
+#endif
+    return check_block(bp);
+}
+
+
+/*
+ * mm_checkop - Check only what the last operation touched: the block
+ *     bp it returned (NULL after mm_free) and the free block its last
+ *     free coalesced into, each together with its neighbors and links.
+ *     Every check costs the same however large the heap is. Returns
+ *     the number of problems found; the same locking rule as for
+ *     mm_checkheap applies.
+ */
+int mm_checkop(void *bp)
+{
+    char *saved = arena;
+    int errs = 0;
+
+    if (bp != NULL)
+        errs += check_touched(bp);
+    if (last_freed != NULL && last_freed != bp)
+        errs += check_touched(last_freed);
+    last_freed = NULL;
+    arena = saved;
+    return errs;
+}
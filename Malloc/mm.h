@@ -5,6 +5,55 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 
+/* Nonzero if mm.c was built thread-safe (MM_THREADS=1) */
+extern const int mm_thread_safe;
+
+/* Allocator statistics since the last mm_init, filled in by mm_info */
+typedef struct {
+    unsigned long tcache_hits;    /* small mallocs served by a thread cache */
+    unsigned long tcache_misses;  /* small mallocs the thread cache missed */
+    unsigned long tcache_flushes; /* cached blocks handed back to the heap */
+    unsigned long slab_allocs;    /* mallocs served by a slab slot */
+    unsigned long slab_runs;      /* runs carved from the slab regions */
+    unsigned long quick_hits;     /* mallocs served by a quick bin */
+    unsigned long quick_sweeps;   /* times the quick bins were coalesced */
+} mm_info_t;
+
+extern void mm_info(mm_info_t *info);
+
+/* Snapshot of the heap layout, filled in by mm_layout; sizes in bytes */
+#define MM_LAYOUT_BINS 16 /* free_hist[i] counts free blocks in [16<<i, 32<<i) */
+typedef struct {
+    size_t heap_bytes;      /* all memory taken from memlib */
+    size_t alloc_bytes;     /* allocated blocks, slots and mappings */
+    size_t parked_bytes;    /* of those, freed ones waiting in bins or caches,
+                               and unused bump runs */
+    size_t free_bytes;      /* free blocks */
+    size_t free_blocks;
+    size_t largest_free;
+    size_t slot_free_bytes; /* free slab slots */
+    size_t other_bytes;     /* the rest: arena and run headers, slack */
+    size_t free_hist[MM_LAYOUT_BINS];
+} mm_layout_t;
+
+extern void mm_layout(mm_layout_t *layout);
+
+/* Allocator parameters for mm_mallopt */
+#define MM_OPT_DEFER 1  /* bytes kept in quick bins before coalescing them */
+#define MM_OPT_PLACE 2  /* placement policy of small blocks, from mm_init on */
+
+/* Placement policies for MM_OPT_PLACE */
+#define MM_PLACE_BEST 0 /* best fit: classes sorted by size (the default) */
+#define MM_PLACE_ADDR 1 /* address-ordered first fit */
+#define MM_PLACE_LIFO 2 /* most recently freed block that fits */
+#define MM_PLACE_BUMP 3 /* new blocks carved from a run per size class */
+
+extern int mm_mallopt(int param, int value);
+
+/* Heap consistency checks; both return the number of problems found */
+extern int mm_checkheap(int verbose);
+extern int mm_checkop(void *bp);
+
 
 /* 
  * Students work in teams of one or two.  Teams enter their team name, 
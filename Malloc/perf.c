@@ -0,0 +1,120 @@
+/*
+ * perf.c - Count hardware events while a function runs, to explain the
+ *     times that fsecs measures: instructions and cycles, last-level
+ *     cache misses, branch mispredictions, data TLB misses on loads and
+ *     page faults.
+ *
+ *     Counters are opened for the calling thread only, in user mode
+ *     (which perf_event_paranoid 2, the usual default, allows), and
+ *     anew by every call, so that a process forked after init_perf
+ *     counts its own events. Counters that are not available (in most
+ *     virtual machines only page faults are) are reported as -1; if the
+ *     kernel had to multiplex a counter, its count is scaled up to the
+ *     whole run.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perf.h"
+
+extern int verbose; /* -v option in mdriver.c */
+
+char *perf_names[PERF_EVENTS] = {
+    "cycles", "instrs", "cache-miss", "branch-miss", "dTLB-miss", "page-fault"
+};
+
+/* type and config of each event */
+static const struct {
+    unsigned int type;
+    unsigned long long config;
+} perf_events[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static int perf_ok[PERF_EVENTS]; /* set by init_perf if the event opens */
+
+/*
+ * perf_open - open a disabled counter for event i on the calling
+ *    thread; returns its file descriptor, or -1
+ */
+static int perf_open(int i)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perf_events[i].type;
+    attr.config = perf_events[i].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * init_perf - find out which events can be counted; returns how many
+ */
+int init_perf(void)
+{
+    int i, fd, n = 0;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	if ((fd = perf_open(i)) < 0) {
+	    if (verbose)
+		printf("Counter %s not available: %s\n", perf_names[i],
+		       strerror(errno));
+	    continue;
+	}
+	close(fd);
+	perf_ok[i] = 1;
+	n++;
+    }
+    return n;
+}
+
+/*
+ * perf_count - Count the events while f(argp) runs n times, and store
+ *    the average per run in counts[0..PERF_EVENTS-1]
+ */
+void perf_count(fsecs_test_funct f, void *argp, int n, double *counts)
+{
+    int fd[PERF_EVENTS];
+    unsigned long long val[3]; /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+	fd[i] = perf_ok[i] ? perf_open(i) : -1;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+	if (fd[i] >= 0)
+	    ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    for (i = 0; i < n; i++)
+	f(argp);
+    for (i = 0; i < PERF_EVENTS; i++)
+	if (fd[i] >= 0)
+	    ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+	counts[i] = -1;
+	if (fd[i] < 0)
+	    continue;
+	if (read(fd[i], val, sizeof(val)) == sizeof(val) && val[2] > 0)
+	    counts[i] = (double)val[0] * val[1] / val[2] / n;
+	close(fd[i]);
+    }
+}
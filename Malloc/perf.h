@@ -0,0 +1,20 @@
+/*
+ * perf.h - Hardware performance counters around a function, through
+ *     the Linux perf_event_open interface
+ */
+#ifndef __PERF_H_
+#define __PERF_H_
+
+#include "fsecs.h"
+
+/* The events counted, in the order of the counts perf_count returns */
+#define PERF_EVENTS 6
+enum {PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES,
+      PERF_DTLB_MISSES, PERF_PAGE_FAULTS};
+
+extern char *perf_names[PERF_EVENTS];
+
+int init_perf(void);
+void perf_count(fsecs_test_funct f, void *argp, int n, double *counts);
+
+#endif /* __PERF_H_ */
@@ -0,0 +1,30 @@
+/*
+ * rep2bin.c - Convert a text .rep trace into the binary trace format
+ *     that read_trace maps instead of parsing (see trace.h).
+ *
+ *     usage: rep2bin <in.rep> <out.bin>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int verbose = 0; /* read by read_trace */
+
+int main(int argc, char **argv)
+{
+    trace_t *trace;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: rep2bin <in.rep> <out.bin>\n");
+        exit(1);
+    }
+    trace = read_trace("", argv[1]);
+    if (write_trace(trace, argv[2]) < 0) {
+        perror(argv[2]);
+        exit(1);
+    }
+    printf("%s: %d ops, %d ids\n", argv[2], trace->num_ops, trace->num_ids);
+    free_trace(trace);
+    return 0;
+}
@@ -0,0 +1,485 @@
+/*
+ * replay.c - Replay a trace on several threads at once against libc
+ *     malloc and mm.c, for mdriver's -T option, or time every request
+ *     of it on one thread, for -L.
+ *
+ * For each thread count from 1 up to the maximum, doubling each time,
+ * the trace is replayed concurrently by that many threads: either each
+ * thread replays a copy of the whole trace with block ids of its own,
+ * or, when sharding, thread t replays only the requests whose block id
+ * is t modulo the thread count, so that a block never changes threads.
+ * Neither mode frees a block on another thread than the one that
+ * allocated it. The handoff mode does: thread t still allocates the
+ * blocks with id t modulo the thread count, but their reallocs and
+ * frees are replayed by thread t+1, which waits (yielding the CPU)
+ * until the block it needs has been allocated. Such frees take the
+ * remote-free path of a multi-arena mm.c; the waits count towards the
+ * wall time but not towards the latency of any request.
+ * Every request is timed with clock_gettime into the thread's latency
+ * histogram; the aggregate throughput is the number of requests over
+ * the wall time from the moment the first thread starts to the moment
+ * the last one finishes, so it includes the timing overhead.
+ *
+ * Only an mm.c built thread-safe (mm_thread_safe, set by MM_THREADS=1)
+ * can be replayed on more than one thread; otherwise just its
+ * one-thread row is shown.
+ *
+ * The latency mode brackets each request with its own pair of clock
+ * readings, less the cost of reading the clock, and files the result
+ * by request type and by the size asked for (for free, the size of the
+ * block freed), so that a rare slow path shows up in the tail
+ * percentiles of the class that takes it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "replay.h"
+
+#define REPLAY_RUNS 3 /* runs per thread count; the fastest is shown */
+
+extern int verbose;
+
+/* The allocator being replayed */
+typedef struct {
+    char *name;
+    int (*init)(void);          /* reset before each run, or NULL */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} alloc_t;
+
+/* Work and results of one replay thread */
+typedef struct {
+    trace_t *trace;
+    alloc_t *alloc;
+    int self;                 /* this thread's number */
+    int nthreads;             /* threads in the run */
+    int mode;                 /* REPLAY_COPY, REPLAY_SHARD or REPLAY_HANDOFF */
+    char **shared;            /* REPLAY_HANDOFF: the blocks of all threads */
+    int *abort;               /* REPLAY_HANDOFF: some thread has failed */
+    pthread_barrier_t *start; /* lets all threads start together */
+    long ops;                 /* requests replayed */
+    unsigned long long begin; /* ns when the replay started... */
+    unsigned long long end;   /* ...and when it finished */
+    int failed;               /* an allocation returned NULL */
+    hist_t hist;              /* latency of each request, in ns */
+} worker_t;
+
+/* Outcome of one run */
+typedef struct {
+    double secs;              /* wall time of the run */
+    long ops;                 /* requests replayed by all threads */
+    int failed;
+    hist_t hist;              /* all threads' latencies together */
+} run_t;
+
+static int mm_reset(void);
+static int replay_op(alloc_t *alloc, char **blocks, traceop_t *op);
+static void *replay_worker(void *arg);
+static void replay_run(trace_t *trace, alloc_t *alloc, int nthreads,
+                       int mode, run_t *run, worker_t *workers);
+static int replay_owner(worker_t *w, traceop_t *op);
+static void print_row(char *label, double kops, double speedup, hist_t *h);
+static int size_class(int size);
+static unsigned long long timer_cost(void);
+
+static char *op_names[] = {"malloc", "free", "realloc"}; /* by type */
+static char *class_names[LAT_CLASSES] = {
+    "<=64", "<=256", "<=1K", "<=4K", "<=16K", ">16K"
+};
+
+static alloc_t allocs[] = {
+    {"libc", NULL, malloc, free, realloc},
+    {"mm", mm_reset, mm_malloc, mm_free, mm_realloc},
+};
+
+/*
+ * now - Return CLOCK_MONOTONIC time in ns
+ */
+static unsigned long long now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * mm_reset - Give mm.c a fresh, empty heap
+ */
+static int mm_reset(void)
+{
+    mem_reset_brk();
+    return mm_init();
+}
+
+/*
+ * replay_threads - Print the scaling curve of libc malloc and mm.c on
+ *     trace number tracenum, from one thread up to maxthreads threads
+ */
+void replay_threads(trace_t *trace, int tracenum, int maxthreads, int mode)
+{
+    worker_t *workers;
+    hist_t *hists;
+    run_t run, best;
+    double base[2] = {0, 0}, kops;
+    char label[32];
+    int a, n, r, i;
+
+    workers = calloc(maxthreads, sizeof(worker_t));
+    hists = calloc(maxthreads, sizeof(hist_t));
+    if (workers == NULL || hists == NULL) {
+        fprintf(stderr, "replay_threads: calloc failed\n");
+        exit(1);
+    }
+    for (n = 1; ; n = 2 * n < maxthreads ? 2 * n : maxthreads) {
+        for (a = 0; a < 2; a++) {
+            if (a == 1 && n > 1 && !mm_thread_safe)
+                continue;
+            for (r = 0; r < REPLAY_RUNS; r++) {
+                replay_run(trace, &allocs[a], n, mode, &run, workers);
+                if (run.failed)
+                    break;
+                if (r == 0 || run.secs < best.secs) {
+                    best = run;
+                    for (i = 0; i < n; i++)
+                        hists[i] = workers[i].hist;
+                }
+            }
+            if (run.failed) {
+                printf("%2d  %-5s %7d  allocation failed\n", tracenum,
+                       allocs[a].name, n);
+                continue;
+            }
+            kops = best.ops / best.secs / 1e3;
+            if (n == 1)
+                base[a] = kops;
+            sprintf(label, "%2d  %-5s %7d", tracenum, allocs[a].name, n);
+            print_row(label, kops, kops / base[a], &best.hist);
+
+            /* -v: the threads of that run one by one */
+            for (i = 0; verbose && n > 1 && i < n; i++) {
+                sprintf(label, "%11s %5d", "thread", i);
+                print_row(label, -1, 0, &hists[i]);
+            }
+        }
+        if (n == maxthreads)
+            break;
+    }
+    free(workers);
+    free(hists);
+}
+
+/*
+ * replay_run - Replay trace on nthreads threads against alloc once,
+ *     leaving the totals in run and each thread's results in workers
+ */
+static void replay_run(trace_t *trace, alloc_t *alloc, int nthreads,
+                       int mode, run_t *run, worker_t *workers)
+{
+    pthread_t *tids;
+    pthread_barrier_t start;
+    unsigned long long begin = 0, end = 0;
+    char **shared = NULL;
+    int abort = 0;
+    int i;
+
+    if (alloc->init != NULL && alloc->init() < 0) {
+        fprintf(stderr, "replay_run: %s init failed\n", alloc->name);
+        exit(1);
+    }
+    if ((tids = malloc(nthreads * sizeof(pthread_t))) == NULL ||
+        (mode == REPLAY_HANDOFF &&
+         (shared = calloc(trace->num_ids, sizeof(char *))) == NULL)) {
+        fprintf(stderr, "replay_run: malloc failed\n");
+        exit(1);
+    }
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].trace = trace;
+        workers[i].alloc = alloc;
+        workers[i].self = i;
+        workers[i].nthreads = nthreads;
+        workers[i].mode = mode;
+        workers[i].shared = shared;
+        workers[i].abort = &abort;
+        workers[i].start = &start;
+        if (pthread_create(&tids[i], NULL, replay_worker, &workers[i]) != 0) {
+            fprintf(stderr, "replay_run: pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    hist_init(&run->hist);
+    run->ops = 0;
+    run->failed = 0;
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(tids[i], NULL);
+        run->ops += workers[i].ops;
+        run->failed |= workers[i].failed;
+        hist_merge(&run->hist, &workers[i].hist);
+        if (i == 0 || workers[i].begin < begin)
+            begin = workers[i].begin;
+        if (workers[i].end > end)
+            end = workers[i].end;
+    }
+    run->secs = (end - begin) / 1e9;
+    pthread_barrier_destroy(&start);
+    free(tids);
+
+    /* handed-off blocks still allocated have no thread left to free them */
+    if (shared != NULL) {
+        for (i = 0; i < trace->num_ids; i++)
+            alloc->free(shared[i]);
+        free(shared);
+    }
+}
+
+/*
+ * replay_owner - Return the number of the thread that replays op
+ */
+static int replay_owner(worker_t *w, traceop_t *op)
+{
+    switch (w->mode) {
+    case REPLAY_SHARD:
+        return op->index % w->nthreads;
+    case REPLAY_HANDOFF:
+        return (op->index + (op->type != ALLOC)) % w->nthreads;
+    default:
+        return w->self;
+    }
+}
+
+/*
+ * replay_op - Carry out request op against alloc, keeping the blocks
+ *     of the trace in blocks. Returns 0 if an allocation failed.
+ */
+static int replay_op(alloc_t *alloc, char **blocks, traceop_t *op)
+{
+    char *p = NULL;
+
+    switch (op->type) {
+    case ALLOC:
+        p = alloc->malloc(op->size);
+        break;
+    case REALLOC:
+        p = alloc->realloc(blocks[op->index], op->size);
+        break;
+    case FREE:
+        alloc->free(blocks[op->index]);
+        break;
+    }
+    /* published for the thread that the block is handed off to */
+    __atomic_store_n(&blocks[op->index], p, __ATOMIC_RELEASE);
+    return op->type == FREE || p != NULL;
+}
+
+/*
+ * replay_worker - Thread body: replay this thread's part of the trace,
+ *     timing each request, then free whatever is still allocated
+ */
+static void *replay_worker(void *arg)
+{
+    worker_t *w = arg;
+    trace_t *trace = w->trace;
+    alloc_t *alloc = w->alloc;
+    char **blocks;
+    traceop_t *op;
+    int *mine, nmine, i, k, ok;
+    unsigned long long t, t2;
+
+    blocks = w->shared ? w->shared : calloc(trace->num_ids, sizeof(char *));
+    mine = malloc(trace->num_ops * sizeof(int));
+    if (blocks == NULL || mine == NULL) {
+        fprintf(stderr, "replay_worker: out of memory\n");
+        exit(1);
+    }
+    for (i = 0, nmine = 0; i < trace->num_ops; i++) {
+        if (replay_owner(w, &trace->ops[i]) == w->self)
+            mine[nmine++] = i;
+    }
+    hist_init(&w->hist);
+    w->failed = 0;
+
+    pthread_barrier_wait(w->start);
+    t = w->begin = now();
+    for (k = 0; k < nmine; k++) {
+        op = &trace->ops[mine[k]];
+        if (w->shared != NULL && op->type != ALLOC &&
+            __atomic_load_n(&blocks[op->index], __ATOMIC_ACQUIRE) == NULL) {
+            /* wait for the previous thread to allocate the block */
+            while (__atomic_load_n(&blocks[op->index], __ATOMIC_ACQUIRE) ==
+                   NULL && !__atomic_load_n(w->abort, __ATOMIC_RELAXED))
+                sched_yield();
+            if (blocks[op->index] == NULL)
+                break;
+            t = now();
+        }
+        ok = replay_op(alloc, blocks, op);
+        t2 = now();
+        hist_add(&w->hist, t2 - t);
+        t = t2;
+        if (!ok) {
+            w->failed = 1;
+            __atomic_store_n(w->abort, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    w->ops = k;
+    w->end = t;
+
+    if (w->shared == NULL) {
+        for (i = 0; i < trace->num_ids; i++)
+            alloc->free(blocks[i]);
+        free(blocks);
+    }
+    free(mine);
+    return NULL;
+}
+
+/*
+ * print_row - Print one line of the scaling table: label, then the
+ *     throughput and speedup unless kops < 0, then the latencies in h
+ */
+static void print_row(char *label, double kops, double speedup, hist_t *h)
+{
+    printf("%s", label);
+    if (kops >= 0)
+        printf(" %9.0f %7.2f", kops, speedup);
+    else
+        printf(" %17s", "");
+    printf(" %7llu %7llu %7llu %9llu\n", hist_percentile(h, 0.5),
+           hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max);
+}
+
+/*
+ * latency_init - Empty all histograms of lat
+ */
+void latency_init(latency_t *lat)
+{
+    int t, c;
+
+    for (t = 0; t < 3; t++)
+        for (c = 0; c < LAT_CLASSES; c++)
+            hist_init(&lat->hist[t][c]);
+}
+
+/*
+ * latency_merge - Add the histograms of src to those of dst
+ */
+void latency_merge(latency_t *dst, latency_t *src)
+{
+    int t, c;
+
+    for (t = 0; t < 3; t++)
+        for (c = 0; c < LAT_CLASSES; c++)
+            hist_merge(&dst->hist[t][c], &src->hist[t][c]);
+}
+
+/*
+ * replay_latency - Replay trace once on this thread against libc malloc
+ *     (mm == 0) or mm.c (mm == 1), adding the latency of every request
+ *     to lat. Returns 0 if an allocation failed.
+ */
+int replay_latency(trace_t *trace, int mm, latency_t *lat)
+{
+    alloc_t *alloc = &allocs[mm];
+    unsigned long long cost = timer_cost(), t, t2;
+    traceop_t *op;
+    char **blocks;
+    int *sizes, i, ok = 1;
+
+    if (alloc->init != NULL && alloc->init() < 0) {
+        fprintf(stderr, "replay_latency: %s init failed\n", alloc->name);
+        exit(1);
+    }
+    blocks = calloc(trace->num_ids, sizeof(char *));
+    sizes = calloc(trace->num_ids, sizeof(int));
+    if (blocks == NULL || sizes == NULL) {
+        fprintf(stderr, "replay_latency: out of memory\n");
+        exit(1);
+    }
+
+    for (i = 0; ok && i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        t = now();
+        ok = replay_op(alloc, blocks, op);
+        t2 = now();
+        if (op->type != FREE)
+            sizes[op->index] = op->size;
+        t2 = t2 - t > cost ? t2 - t - cost : 0;
+        hist_add(&lat->hist[op->type][size_class(sizes[op->index])], t2);
+    }
+
+    for (i = 0; i < trace->num_ids; i++)
+        alloc->free(blocks[i]);
+    free(blocks);
+    free(sizes);
+    return ok;
+}
+
+/*
+ * print_latency - Print the latency percentiles of libc malloc (mm ==
+ *     0) or mm.c (mm == 1) in lat, one line per request type and size
+ *     class that occurred, labeled with tracename
+ */
+void print_latency(char *tracename, int mm, latency_t *lat)
+{
+    hist_t *h;
+    int t, c;
+
+    for (t = 0; t < 3; t++) {
+        for (c = 0; c < LAT_CLASSES; c++) {
+            h = &lat->hist[t][c];
+            if (h->count == 0)
+                continue;
+            printf("%-4s%-5s %-7s %-5s %9llu %7llu %7llu %7llu %9llu\n",
+                   tracename, allocs[mm].name, op_names[t], class_names[c],
+                   h->count, hist_percentile(h, 0.5),
+                   hist_percentile(h, 0.99), hist_percentile(h, 0.999),
+                   h->max);
+        }
+    }
+}
+
+/*
+ * size_class - Return the latency size class of a request for size bytes
+ */
+static int size_class(int size)
+{
+    int c = 0, limit = 64;
+
+    while (c < LAT_CLASSES - 1 && size > limit) {
+        c++;
+        limit <<= 2;
+    }
+    return c;
+}
+
+/*
+ * timer_cost - Return the least time between two clock readings, which
+ *     every timed request pays on top of its own; measured once
+ */
+static unsigned long long timer_cost(void)
+{
+    static unsigned long long cost = ~0ULL;
+    unsigned long long t, t2;
+    int i;
+
+    if (cost == ~0ULL) {
+        for (i = 0; i < 1000; i++) {
+            t = now();
+            t2 = now();
+            if (t2 - t < cost)
+                cost = t2 - t;
+        }
+    }
+    return cost;
+}
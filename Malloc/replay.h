@@ -0,0 +1,29 @@
+/*
+ * replay.h - Replaying a trace on several threads at once, to measure
+ *     how an allocator copes with contention, and timing every request
+ *     of a trace, to see the slow ones that averages hide.
+ */
+#ifndef __REPLAY_H_
+#define __REPLAY_H_
+
+#include "trace.h"
+#include "hist.h"
+
+/* Latencies by request type and size: up to 64 bytes, 256, 1K, 4K, 16K, more */
+#define LAT_CLASSES 6
+typedef struct {
+    hist_t hist[3][LAT_CLASSES]; /* indexed by traceop_t type, size class */
+} latency_t;
+
+/* How replay_threads spreads a trace over the threads */
+#define REPLAY_COPY    0 /* every thread replays a copy of the whole trace */
+#define REPLAY_SHARD   1 /* thread t replays the blocks with id t mod n */
+#define REPLAY_HANDOFF 2 /* as REPLAY_SHARD, but blocks die on the next thread */
+
+void replay_threads(trace_t *trace, int tracenum, int maxthreads, int mode);
+void latency_init(latency_t *lat);
+void latency_merge(latency_t *dst, latency_t *src);
+int replay_latency(trace_t *trace, int mm, latency_t *lat);
+void print_latency(char *tracename, int mm, latency_t *lat);
+
+#endif /* __REPLAY_H_ */
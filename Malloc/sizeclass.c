@@ -0,0 +1,193 @@
+/*
+ * sizeclass.c - Derive the free list size classes of mm.c from the
+ *     request sizes in the traces.
+ *
+ * Reads the traces with read_trace(), builds a histogram of the block
+ * sizes the requests turn into (payload plus header, rounded up to
+ * ALIGNMENT) below SC_LIMIT bytes, and splits it into classes that
+ * each cover about the same number of requests. The result goes to
+ * stdout as a C header with the class boundaries and a table that maps
+ * size >> SC_SHIFT straight to a class; "make classes" writes it to
+ * sizeclass.h.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "config.h"
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+#define SC_SHIFT 4 /* the table has one entry per 16 bytes */
+#define SC_LIMIT (1 << 10) /* mm.c's TREE_MIN: larger blocks live in a tree */
+#define SC_ENTRIES (SC_LIMIT >> SC_SHIFT)
+#define MIN_BLOCK 16 /* smallest block mm.c hands out */
+#define HDR_SIZE 4 /* block header in front of each payload */
+#define DEF_CLASSES 6 /* mm.c's default number of free lists */
+
+#define ALIGN(size) (((size) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+
+int verbose = 0; /* -v: also print the histogram to stderr */
+
+static char *default_tracefiles[] = {
+    DEFAULT_TRACEFILES, NULL
+};
+
+static void usage(void);
+
+int main(int argc, char **argv)
+{
+    char tracedir[MAXLINE] = TRACEDIR;
+    char *onefile[2] = {NULL, NULL};
+    char **tracefiles = default_tracefiles;
+    double hist[SC_ENTRIES];
+    int bound[SC_ENTRIES + 1];
+    int table[SC_ENTRIES];
+    double total, cum, share;
+    int nclasses = DEF_CLASSES;
+    int ntraces = 0;
+    int i, k, b, c;
+    trace_t *trace;
+    size_t asize;
+
+    while ((c = getopt(argc, argv, "f:t:n:hv")) != EOF) {
+        switch (c) {
+        case 'f': /* Use one specific trace file only (relative to curr dir) */
+            strcpy(tracedir, "./");
+            onefile[0] = optarg;
+            tracefiles = onefile;
+            break;
+        case 't': /* Directory where the traces are located */
+            if (tracefiles == onefile) /* ignore if -f already encountered */
+                break;
+            strcpy(tracedir, optarg);
+            if (tracedir[strlen(tracedir)-1] != '/')
+                strcat(tracedir, "/"); /* path always ends with "/" */
+            break;
+        case 'n': /* Number of classes */
+            nclasses = atoi(optarg);
+            if (nclasses < 1 || nclasses > SC_ENTRIES - 1) {
+                usage();
+                exit(1);
+            }
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+
+    /* Count every malloc and realloc by the block size it asks for */
+    for (i = 0; i < SC_ENTRIES; i++)
+        hist[i] = 0;
+    total = 0;
+    for (i = 0; tracefiles[i] != NULL; i++) {
+        trace = read_trace(tracedir, tracefiles[i]);
+        for (k = 0; k < trace->num_ops; k++) {
+            if (trace->ops[k].type == FREE)
+                continue;
+            asize = ALIGN(trace->ops[k].size + HDR_SIZE);
+            if (asize < MIN_BLOCK)
+                asize = MIN_BLOCK;
+            if (asize >= SC_LIMIT)
+                continue;
+            hist[asize >> SC_SHIFT]++;
+            total++;
+        }
+        free_trace(trace);
+        ntraces++;
+    }
+    if (total == 0) {
+        fprintf(stderr, "sizeclass: no requests below %d bytes\n", SC_LIMIT);
+        exit(1);
+    }
+
+    /*
+     * Class k starts at the first entry by which k/nclasses of the
+     * requests have been seen; every class keeps at least one entry,
+     * so a single very common size cannot swallow its neighbors.
+     */
+    b = MIN_BLOCK >> SC_SHIFT;
+    bound[0] = b;
+    cum = 0;
+    for (k = 1; k < nclasses; k++) {
+        while (b < SC_ENTRIES - (nclasses - k) &&
+               (b <= bound[k-1] || cum < total * k / nclasses))
+            cum += hist[b++];
+        bound[k] = b;
+    }
+    bound[nclasses] = SC_ENTRIES;
+    for (k = 0, i = 0; i < SC_ENTRIES; i++) {
+        while (k < nclasses - 1 && i >= bound[k+1])
+            k++;
+        table[i] = k;
+    }
+
+    if (verbose) {
+        for (i = 0; i < SC_ENTRIES; i++) {
+            if (hist[i] > 0)
+                fprintf(stderr, "%5d %8.0f  class %d\n",
+                        i << SC_SHIFT, hist[i], table[i]);
+        }
+    }
+
+    printf("/*\n");
+    printf(" * sizeclass.h - Free list size classes for mm.c, generated by\n");
+    printf(" *     \"make classes\" from %.0f requests in %d trace%s; do not\n",
+           total, ntraces, ntraces == 1 ? "" : "s");
+    printf(" *     edit by hand.\n");
+    printf(" *\n");
+    printf(" *     class  block sizes    requests\n");
+    for (k = 0; k < nclasses; k++) {
+        share = 0;
+        for (i = bound[k]; i < bound[k+1]; i++)
+            share += hist[i];
+        printf(" *     %5d  [%4d, %4d)    %6.1f%%\n", k,
+               bound[k] << SC_SHIFT, bound[k+1] << SC_SHIFT,
+               100.0 * share / total);
+    }
+    printf(" */\n");
+    printf("#ifndef __SIZECLASS_H_\n");
+    printf("#define __SIZECLASS_H_\n\n");
+    printf("#define SC_CLASSES %d /* number of classes */\n", nclasses);
+    printf("#define SC_SHIFT %d /* table index is size >> SC_SHIFT */\n",
+           SC_SHIFT);
+    printf("#define SC_ENTRIES %d /* table covers sizes below %d */\n\n",
+           SC_ENTRIES, SC_LIMIT);
+    printf("/* Lower bound of each class, then SC_ENTRIES << SC_SHIFT */\n");
+    printf("#define SC_BOUNDS {");
+    for (k = 0; k <= nclasses; k++)
+        printf("%s%d", k ? ", " : " ", bound[k] << SC_SHIFT);
+    printf(" }\n\n");
+    printf("/* Class of every size below SC_ENTRIES << SC_SHIFT */\n");
+    printf("#define SC_TABLE { \\\n");
+    for (i = 0; i < SC_ENTRIES; i++) {
+        printf("%s%d%s", i % 16 ? " " : "    ", table[i],
+               i == SC_ENTRIES - 1 ? " \\\n" : (i % 16 == 15 ? ", \\\n" : ","));
+    }
+    printf("}\n\n");
+    printf("#endif /* __SIZECLASS_H_ */\n");
+    return 0;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: sizeclass [-hv] [-f <file>] [-t <dir>] [-n <classes>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-f <file>    Use <file> as the only trace file.\n");
+    fprintf(stderr, "\t-h           Print this message.\n");
+    fprintf(stderr, "\t-n <classes> Number of size classes (default %d).\n",
+            DEF_CLASSES);
+    fprintf(stderr, "\t-t <dir>     Directory to find default traces.\n");
+    fprintf(stderr, "\t-v           Print the size histogram to stderr.\n");
+}
@@ -0,0 +1,32 @@
+/*
+ * sizeclass.h - Free list size classes for mm.c, generated by
+ *     "make classes" from 30719 requests in 11 traces; do not
+ *     edit by hand.
+ *
+ *     class  block sizes    requests
+ *         0  [  16,   48)      30.6%
+ *         1  [  48,   96)      10.2%
+ *         2  [  96,  144)      13.2%
+ *         3  [ 144,  160)      28.7%
+ *         4  [ 160,  192)       3.4%
+ *         5  [ 192, 1024)      14.0%
+ */
+#ifndef __SIZECLASS_H_
+#define __SIZECLASS_H_
+
+#define SC_CLASSES 6 /* number of classes */
+#define SC_SHIFT 4 /* table index is size >> SC_SHIFT */
+#define SC_ENTRIES 64 /* table covers sizes below 1024 */
+
+/* Lower bound of each class, then SC_ENTRIES << SC_SHIFT */
+#define SC_BOUNDS { 16, 48, 96, 144, 160, 192, 1024 }
+
+/* Class of every size below SC_ENTRIES << SC_SHIFT */
+#define SC_TABLE { \
+    0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 4, 4, 5, 5, 5, 5, \
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, \
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, \
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5 \
+}
+
+#endif /* __SIZECLASS_H_ */
@@ -0,0 +1,279 @@
+/*
+ * trace.c - Read a trace file into memory and free it again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+extern int verbose; /* -v option of the program reading the trace */
+
+static void parse_ops(trace_t *trace, FILE *tracefile, char *path);
+static void map_ops(trace_t *trace, trace_hdr_t *hdr, int fd, char *path);
+static void unix_error(char *msg);
+
+
+/*
+ * read_trace - read a trace file and store it in memory. Binary traces
+ *     (see trace.h) are mapped rather than read; anything else is
+ *     parsed as a text .rep file.
+ */
+trace_t *read_trace(char *tracedir, char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    trace_hdr_t hdr;
+    char path[MAXLINE];
+    char msg[MAXLINE];
+
+    if (verbose > 1)
+	printf("Reading tracefile: %s\n", filename);
+
+    /* Allocate the trace record */
+    if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
+	unix_error("malloc 1 failed in read_trance");
+	
+    /* Read the trace file header */
+    strcpy(path, tracedir);
+    strcat(path, filename);
+    if ((tracefile = fopen(path, "r")) == NULL) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fread(&hdr, sizeof(hdr), 1, tracefile) == 1 &&
+	memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) == 0)
+	map_ops(trace, &hdr, fileno(tracefile), path);
+    else {
+	rewind(tracefile);
+	parse_ops(trace, tracefile, path);
+    }
+    fclose(tracefile);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+    
+    return trace;
+}
+
+/*
+ * parse_ops - Read the header and every request line of text trace
+ *     file tracefile into trace
+ */
+static void parse_ops(trace_t *trace, FILE *tracefile, char *path)
+{
+    char type[MAXLINE];
+    unsigned index, size;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
+    fscanf(tracefile, "%d", &(trace->num_ids));     
+    fscanf(tracefile, "%d", &(trace->num_ops));     
+    fscanf(tracefile, "%d", &(trace->weight));        /* not used */
+    
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = 
+	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+	unix_error("malloc 2 failed in read_trace");
+    trace->tids = NULL;
+    trace->times = NULL;
+    trace->map = NULL;
+    trace->map_len = 0;
+
+    /* read every request line in the trace file */
+    index = 0;
+    op_index = 0;
+    while (fscanf(tracefile, "%s", type) != EOF) {
+	switch(type[0]) {
+	case 'a':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = ALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'r':
+	    fscanf(tracefile, "%u %u", &index, &size);
+	    trace->ops[op_index].type = REALLOC;
+	    trace->ops[op_index].index = index;
+	    trace->ops[op_index].size = size;
+	    max_index = (index > max_index) ? index : max_index;
+	    break;
+	case 'f':
+	    fscanf(tracefile, "%ud", &index);
+	    trace->ops[op_index].type = FREE;
+	    trace->ops[op_index].index = index;
+	    break;
+	default:
+	    printf("Bogus type character (%c) in tracefile %s\n", 
+		   type[0], path);
+	    exit(1);
+	}
+	op_index++;
+	
+    }
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+}
+
+/*
+ * map_ops - Map the packed requests of binary trace file fd, whose
+ *     header hdr has been read already, straight into trace->ops. The
+ *     only pass over them checks that every index is in range, so that
+ *     a damaged file cannot make the driver write out of bounds.
+ */
+static void map_ops(trace_t *trace, trace_hdr_t *hdr, int fd, char *path)
+{
+    struct stat st;
+    size_t len, tids_off = 0, times_off = 0;
+    char msg[MAXLINE];
+    int i;
+
+    len = sizeof(trace_hdr_t) + (size_t)hdr->num_ops * sizeof(traceop_t);
+    if (hdr->flags & TRACE_THREADS) {
+	tids_off = ALIGN8(len);
+	times_off = ALIGN8(tids_off + (size_t)hdr->num_ops * sizeof(int));
+	len = times_off + (size_t)hdr->num_ops * sizeof(long long);
+    }
+    if (hdr->op_size != sizeof(traceop_t) || hdr->num_ops < 0 ||
+	(hdr->flags & ~TRACE_THREADS) != 0 ||
+	hdr->num_ids < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size != len) {
+	printf("Bad header or length in binary tracefile %s\n", path);
+	exit(1);
+    }
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+
+    /* The ops are read-only; the driver never writes to them */
+    trace->map_len = len;
+    if ((trace->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+	MAP_FAILED) {
+	sprintf(msg, "Could not map %s in read_trace", path);
+	unix_error(msg);
+    }
+    trace->ops = (traceop_t *)((char *)trace->map + sizeof(trace_hdr_t));
+    trace->tids = tids_off ? (int *)((char *)trace->map + tids_off) : NULL;
+    trace->times = times_off ?
+	(long long *)((char *)trace->map + times_off) : NULL;
+
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].index < 0 || trace->ops[i].index >= trace->num_ids ||
+	    (unsigned)trace->ops[i].type > REALLOC ||
+	    (trace->ops[i].type != FREE && trace->ops[i].size <= 0)) {
+	    printf("Bogus request %d in binary tracefile %s\n", i, path);
+	    exit(1);
+	}
+    }
+}
+
+/*
+ * write_trace - Write the header and requests of trace to path as a
+ *     binary trace, along with its thread ids and timestamps if it has
+ *     them. Returns 0 on success and -1 on error.
+ */
+int write_trace(trace_t *trace, char *path)
+{
+    static const char zero[8];
+    FILE *f;
+    trace_hdr_t hdr;
+    size_t len;
+    int ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+    hdr.op_size = sizeof(traceop_t);
+    if (trace->tids != NULL && trace->times != NULL)
+	hdr.flags = TRACE_THREADS;
+
+    if ((f = fopen(path, "w")) == NULL)
+	return -1;
+    ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+	fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, f) ==
+	(size_t)trace->num_ops;
+    if (ok && hdr.flags) {
+	len = sizeof(hdr) + (size_t)trace->num_ops * sizeof(traceop_t);
+	ok = fwrite(zero, 1, ALIGN8(len) - len, f) == ALIGN8(len) - len &&
+	    fwrite(trace->tids, sizeof(int), trace->num_ops, f) ==
+	    (size_t)trace->num_ops;
+	len = ALIGN8(len) + (size_t)trace->num_ops * sizeof(int);
+	ok = ok && fwrite(zero, 1, ALIGN8(len) - len, f) == ALIGN8(len) - len &&
+	    fwrite(trace->times, sizeof(long long), trace->num_ops, f) ==
+	    (size_t)trace->num_ops;
+    }
+    if (fclose(f) != 0 || !ok)
+	return -1;
+    return 0;
+}
+
+/*
+ * write_rep - Write the header and requests of trace to path as a text
+ *     .rep file. Returns 0 on success and -1 on error.
+ */
+int write_rep(trace_t *trace, char *path)
+{
+    traceop_t *op;
+    FILE *f;
+    int i, ok;
+
+    if ((f = fopen(path, "w")) == NULL)
+	return -1;
+    ok = fprintf(f, "%d\n%d\n%d\n%d\n", trace->sugg_heapsize,
+		 trace->num_ids, trace->num_ops, trace->weight) > 0;
+    for (i = 0; ok && i < trace->num_ops; i++) {
+	op = &trace->ops[i];
+	if (op->type == FREE)
+	    ok = fprintf(f, "f %d\n", op->index) > 0;
+	else
+	    ok = fprintf(f, "%c %d %d\n", op->type == ALLOC ? 'a' : 'r',
+			 op->index, op->size) > 0;
+    }
+    if (fclose(f) != 0 || !ok)
+	return -1;
+    return 0;
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in read_trace().
+ *              Mapped requests are unmapped instead.
+ */
+void free_trace(trace_t *trace)
+{
+    if (trace->map != NULL)   /* unmap or free the three arrays... */
+	munmap(trace->map, trace->map_len);
+    else
+	free(trace->ops);
+    free(trace->blocks);      
+    free(trace->block_sizes);
+    free(trace);              /* and the trace record itself... */
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    printf("%s: %s\n", msg, strerror(errno));
+    exit(1);
+}
@@ -0,0 +1,62 @@
+/*
+ * trace.h - Reading malloc lab trace files into memory; shared by the
+ * driver and the tools that analyze traces.
+ *
+ * Besides the text .rep format, read_trace accepts binary traces: a
+ * trace_hdr_t followed by num_ops packed traceop_t records, in the
+ * byte order and layout of the machine that wrote them. These are
+ * mapped into memory as they are, so even traces with millions of
+ * requests load without parsing. write_trace produces them, and
+ * write_rep writes a trace back out as text. Traces
+ * captured from real programs (see capture.c) may also carry the
+ * thread and time of every request: with TRACE_THREADS set in the
+ * header, num_ops ints of thread ids and then num_ops long longs of
+ * nanosecond timestamps follow the requests, each array starting on
+ * an 8-byte boundary.
+ */
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stddef.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int *tids;           /* thread of each request, or NULL */
+    long long *times;    /* ns since the first request, or NULL */
+    void *map;           /* mapping of a binary trace file, or NULL */
+    size_t map_len;      /* length of that mapping */
+} trace_t;
+
+/* Header of a binary trace file */
+#define TRACE_MAGIC "MMTRACE1"
+#define TRACE_THREADS 0x1 /* flags: thread ids and timestamps follow */
+typedef struct {
+    char magic[8];       /* TRACE_MAGIC, without its terminating 0 */
+    int sugg_heapsize;   /* the four header values of a .rep file */
+    int num_ids;
+    int num_ops;
+    int weight;
+    int op_size;         /* sizeof(traceop_t) on the writing machine */
+    int flags;           /* TRACE_THREADS or zero; keeps the ops aligned */
+} trace_hdr_t;
+
+trace_t *read_trace(char *tracedir, char *filename);
+void free_trace(trace_t *trace);
+int write_trace(trace_t *trace, char *path);
+int write_rep(trace_t *trace, char *path);
+
+#endif /* __TRACE_H_ */